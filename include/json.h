@@ -27,13 +27,33 @@
 
 struct json;
 
+/**
+ * Data types.
+ *
+ * Every JSON value has one of these types. The enumeration identifies the kind
+ * of value stored in a struct json, allowing code to inspect or validate data
+ * before accessing it.
+ */
+
+enum json_type {
+    JSON_TYPE_OBJECT,
+    JSON_TYPE_ARRAY,
+    JSON_TYPE_STRING,
+    JSON_TYPE_NUMBER,
+    JSON_TYPE_BOOLEAN,
+    JSON_TYPE_NULL
+};
+
+enum json_type json_type(const struct json *json);
+
 /**
  * Parsing and printing functions.
  *
  * Reads JSON text from a stream and constructs the corresponding value tree.
  * On success, it returns the root value and sets status to `JSON_SUCCESS`.
  * On failure, it returns NULL and sets status to describe the first error
- * encountered.
+ * encountered.  Functions that read JSON text from a buffer report running
+ * out of memory as JSON_OUT_OF_MEMORY, distinct from any error in the text.
  */
 
 enum json_status {
@@ -41,12 +61,224 @@ enum json_status {
     JSON_UNEXPECTED_CHARACTER,
     JSON_UNEXPECTED_FILE_END,
     JSON_INVALID_ESCAPE,
-    JSON_INVALID_UNICODE
+    JSON_INVALID_UNICODE,
+    JSON_NESTING_TOO_DEEP,
+    JSON_INVALID_PATH,
+    JSON_OUT_OF_MEMORY
 };
 
 struct json *json_parse(FILE *in, enum json_status *status);
 void json_print(const struct json *json, FILE *out);
 
+/**
+ * Prints like json_print, but with the members of every object in sorted key
+ * order, so the output does not depend on the order members were added in.
+ * Keys are ordered as in canonical output below.  Each object keeps its
+ * sorted order until a member is added or removed, so printing the same
+ * document again does not sort it again.  Returns false if memory runs out;
+ * the output is then incomplete.
+ */
+
+bool json_print_sorted(const struct json *json, FILE *out);
+
+/**
+ * Canonical output (RFC 8785, JSON Canonicalization Scheme).
+ *
+ * Writes a value without whitespace, with object members sorted by key as
+ * UTF-16 code units, numbers in their shortest round-trip form as formatted
+ * by ECMAScript, and strings escaped only where JSON requires it.  Returns
+ * false if the value holds a number that is not finite, which has no JSON
+ * form, or if memory runs out; the output is then incomplete.
+ */
+
+bool json_print_canonical(const struct json *json, FILE *out);
+
+/**
+ * Validation without parsing.
+ *
+ * Checks that a buffer holds exactly one well-formed JSON value without
+ * creating values or allocating memory.  Returns true on success.  On
+ * failure, status describes the first error and offset is set to its
+ * position in the buffer.  Either pointer may be NULL.
+ */
+
+bool json_validate(const uint8_t *buffer, size_t length,
+                   enum json_status *status, size_t *offset);
+
+/**
+ * Parsing with field projection.
+ *
+ * Parses like json_parse, but keeps only the values on or under the given
+ * paths.  Paths use JSON Pointer syntax, such as `/user/id`, where a segment
+ * consisting of `*` matches any member or element, and at most 64 paths may
+ * be given.  Everything else is skipped by matching brackets without
+ * creating values or decoding strings; skipped text is only checked for
+ * balanced brackets and well-formed strings.  Containers leading to a kept
+ * path hold only the members and elements on the way to it.
+ */
+
+struct json *json_parse_projected(FILE *in, const uint8_t *const *paths,
+                                  size_t count, enum json_status *status);
+
+/**
+ * Interned keys.
+ *
+ * A key pool stores one copy of each distinct object key.  Parsing with a
+ * pool makes all objects share the pooled copies instead of duplicating each
+ * key, and lets lookups compare keys by address.  A pool may be shared by
+ * any number of documents parsed on the same thread.  Without a pool,
+ * json_parse_interned uses a temporary one for the single document, and
+ * sets status to JSON_OUT_OF_MEMORY if it cannot create it.  Only the
+ * parser interns keys; values built with json_object_add never use a pool.
+ *
+ * Pooled keys are released with the documents that use them, so a pool may
+ * be freed at any time, even while its documents are still in use.
+ */
+
+struct json_keys;
+
+struct json_keys *json_keys_new(void);
+void              json_keys_free(struct json_keys *keys);
+
+struct json *json_parse_interned(FILE *in, struct json_keys *keys,
+                                 enum json_status *status);
+
+/**
+ * Precomputed keys.
+ *
+ * A key handle carries the hash of a key, so that looking the same key up in
+ * many objects with json_object_get_key does not hash it again.  A handle
+ * made by json_key refers to the caller's text, which must outlive it.  A
+ * handle made by json_key_in holds a reference to the pooled copy of the key
+ * instead, and matches members interned in that pool by address; it must be
+ * released with json_key_release.
+ */
+
+struct json_key {
+    const uint8_t *text;
+    uint64_t hash;
+    bool interned;
+};
+
+struct json_key json_key(const uint8_t *key);
+struct json_key json_key_in(struct json_keys *keys, const uint8_t *key);
+void            json_key_release(struct json_key *key);
+
+/**
+ * On-demand documents.
+ *
+ * Opening a document validates the text in a buffer and records the position
+ * of every value, but creates no values.  A value is materialized only when
+ * it is first reached through the access functions below, and then only one
+ * level deep, so untouched subtrees are never allocated or unescaped.  The
+ * keys of materialized objects are interned in a pool owned by the document.
+ *
+ * The buffer is not copied and must outlive the document.  The document owns
+ * the root value and every value reached from it; closing the document frees
+ * them, and values removed from the tree must not outlive the document.
+ * json_doc_open returns NULL and sets status if the text is invalid or
+ * memory runs out.
+ */
+
+struct json_doc;
+
+struct json_doc *json_doc_open(const uint8_t *buffer, size_t length,
+                               enum json_status *status);
+struct json     *json_doc_root(struct json_doc *doc);
+void             json_doc_close(struct json_doc *doc);
+
+/**
+ * Flat documents.
+ *
+ * A tape is an immutable alternative to the value tree: the whole document
+ * is stored in one contiguous array of 64-bit words, with every string in a
+ * single side buffer, so traversal reads memory sequentially.  Values are
+ * identified by their position on the tape.  The root is at position 0;
+ * json_tape_first returns the first member or element of a container, and
+ * json_tape_next steps over any value, including a whole container, to the
+ * one that follows.  Object members appear as a key followed by its value.
+ * Functions that find a value return JSON_TAPE_NONE when there is none.
+ * json_tape_parse returns NULL and sets status if the text is invalid or
+ * memory runs out.
+ *
+ * A tape holds no pointers and can be written to a stream and read back
+ * without parsing, on hosts with the same byte order.  json_tape_read checks
+ * the structure of what it loads and returns NULL if the data is truncated
+ * or malformed.
+ */
+
+struct json_tape;
+
+#define JSON_TAPE_NONE SIZE_MAX
+
+struct json_tape *json_tape_parse(const uint8_t *buffer, size_t length,
+                                  enum json_status *status);
+void              json_tape_free(struct json_tape *tape);
+
+bool              json_tape_write(const struct json_tape *tape, FILE *out);
+struct json_tape *json_tape_read(FILE *in);
+
+enum json_type  json_tape_type(const struct json_tape *tape, size_t at);
+size_t          json_tape_first(const struct json_tape *tape, size_t at);
+size_t          json_tape_next(const struct json_tape *tape, size_t at);
+size_t          json_tape_length(const struct json_tape *tape, size_t at);
+size_t          json_tape_object_get(const struct json_tape *tape, size_t at,
+                                     const uint8_t *key);
+size_t          json_tape_array_get(const struct json_tape *tape, size_t at,
+                                    size_t index);
+const uint8_t  *json_tape_string(const struct json_tape *tape, size_t at,
+                                 size_t *length);
+double          json_tape_number(const struct json_tape *tape, size_t at);
+bool            json_tape_boolean(const struct json_tape *tape, size_t at);
+
+/**
+ * CBOR (RFC 8949).
+ *
+ * json_to_cbor writes a value as one CBOR item.  Numbers that are integral
+ * and fit in 64 bits are written as integers, and all others as the
+ * shortest of a half, single, or double precision float that holds them
+ * exactly.  Returns false if the output fails.
+ *
+ * json_from_cbor reads the single CBOR item that fills a buffer, or returns
+ * NULL and sets status, which may be NULL, to the error, which is
+ * JSON_OUT_OF_MEMORY if memory runs out.  Integers
+ * become doubles and lose precision beyond 2^53.  Byte strings become
+ * base64url text, tags are ignored, and non-finite floats and simple values
+ * other than booleans and null become null.  Map keys must be text.
+ */
+
+bool         json_to_cbor(const struct json *json, FILE *out);
+struct json *json_from_cbor(const uint8_t *buffer, size_t length,
+                            enum json_status *status);
+
+/**
+ * MessagePack.
+ *
+ * json_to_msgpack writes a value as one MessagePack item, and
+ * json_from_msgpack reads one back from a buffer, as json_to_cbor and
+ * json_from_cbor do for CBOR.  Integers from -2^63 to 2^64 are written in
+ * the smallest integer format, and other numbers as float32 when that is
+ * exact, or float64.  Binary and extension data are read as base64url text,
+ * and map keys must be strings.
+ *
+ * The json_msgpack_ functions write single items to a stream, so that
+ * MessagePack can be produced without building values: an array or map
+ * header gives the number of elements or members, which must follow it, a
+ * member being a string key and then its value.  Every writer returns false
+ * if the output fails or a length does not fit in 32 bits.
+ */
+
+bool         json_to_msgpack(const struct json *json, FILE *out);
+struct json *json_from_msgpack(const uint8_t *buffer, size_t length,
+                               enum json_status *status);
+
+bool json_msgpack_map(FILE *out, size_t count);
+bool json_msgpack_array(FILE *out, size_t count);
+bool json_msgpack_string(FILE *out, const uint8_t *text, size_t length);
+bool json_msgpack_number(FILE *out, double number);
+bool json_msgpack_boolean(FILE *out, bool value);
+bool json_msgpack_null(FILE *out);
+
 /**
  * Value creation functions.
  *
@@ -65,23 +297,46 @@ struct json *json_new_null(void);
 void json_free(struct json *value);
 
 /**
- * Data types.
+ * Returns a deep copy of a value, owned by the caller, or NULL if memory runs
+ * out.  The copy is independent of the original: it is never frozen, and it
+ * remains valid after the original, or its document, is freed.
+ */
+
+struct json *json_clone(const struct json *json);
+
+/**
+ * Structural comparison.
  *
- * Every JSON value has one of these types. The enumeration identifies the kind
- * of value stored in a struct json, allowing code to inspect or validate data
- * before accessing it.
+ * json_equal compares two values by type and contents: numbers by value,
+ * arrays element by element in order, and objects by their set of keys and
+ * values regardless of order.  json_hash returns a 64-bit hash such that
+ * equal values have equal hashes; it is the same in every process, so it can
+ * be used as a content address.
  */
 
-enum json_type {
-    JSON_TYPE_OBJECT,
-    JSON_TYPE_ARRAY,
-    JSON_TYPE_STRING,
-    JSON_TYPE_NUMBER,
-    JSON_TYPE_BOOLEAN,
-    JSON_TYPE_NULL
-};
+bool     json_equal(const struct json *a, const struct json *b);
+uint64_t json_hash(const struct json *json);
 
-enum json_type json_type(const struct json *json);
+/**
+ * Frozen values.
+ *
+ * Freezing a value makes it and everything below it immutable, so that the
+ * tree can be read by any number of threads at once, and gives every value
+ * in it an atomic reference count.  Functions that would change a frozen
+ * value fail instead.  json_retain takes another reference to a frozen value,
+ * or to a subtree of one, and returns the value to use; json_release, like
+ * json_free, drops one.  A frozen tree is freed as its last holder releases
+ * it, so a subtree handed to another thread outlives the rest of the tree.
+ *
+ * Freezing expands the values of an on-demand document and copies their
+ * keys out of its pool, so retained subtrees also outlive the document.
+ * json_freeze fails, leaving the tree unfrozen, if memory runs out.
+ */
+
+bool         json_freeze(struct json *json);
+bool         json_is_frozen(const struct json *json);
+struct json *json_retain(struct json *json);
+void         json_release(struct json *json);
 
 /**
  * Modify JSON objects by adding or removing key–value pairs.
@@ -91,35 +346,261 @@ enum json_type json_type(const struct json *json);
  * object on success.
  *
  * Removing a pair deletes the entry for the specified key. If the key does not
- * exist, the operation has no effect and returns false.
+ * exist, the operation has no effect and returns false.  json_object_remove_if
+ * deletes every entry for which the predicate returns true, in one pass over
+ * the object, and returns the number of entries deleted.
  */
 
-bool json_object_add(struct json *json, const uint8_t *key, struct json *value);
-bool json_object_remove(struct json *json, const uint8_t *key);
+bool   json_object_add(struct json *json, const uint8_t *key, struct json *value);
+bool   json_object_remove(struct json *json, const uint8_t *key);
+size_t json_object_remove_if(struct json *json,
+                             bool (*predicate)(const uint8_t *key,
+                                               struct json *value,
+                                               void *context),
+                             void *context);
 
 /**
  * Modify JSON arrays by adding, removing, and inspecting elements.
  *
  * When adding a value, ownership transfers to the array on success. Removing
  * an element releases its storage and shifts subsequent elements down by one
- * position.
+ * position.  json_array_remove_range releases `count` elements starting at
+ * `index` and shifts the rest down once; it fails if the range does not lie
+ * within the array.
+ *
+ * json_array_insert places a value before the element at `index`, or at the
+ * end when `index` equals the length.  json_array_splice replaces `count`
+ * elements starting at `index` with `n` new values, taking ownership of them
+ * on success; on failure, the array is unchanged.
+ *
+ * json_array_reserve allocates room for at least `capacity` elements, so that
+ * adding up to that many never reallocates.  json_array_shrink_to_fit
+ * releases capacity beyond the current length.
  */
 
 bool   json_array_add(struct json *json, struct json *value);
+bool   json_array_insert(struct json *json, size_t index, struct json *value);
+bool   json_array_splice(struct json *json, size_t index, size_t count,
+                         struct json *const *values, size_t n);
 bool   json_array_remove(struct json *json, size_t index);
+bool   json_array_remove_range(struct json *json, size_t index, size_t count);
+bool   json_array_reserve(struct json *json, size_t capacity);
+void   json_array_shrink_to_fit(struct json *json);
 size_t json_array_length(const struct json *json);
 
 /**
  * Read access to values stored within objects and arrays.
  *
  * When applied to an object, retrieves the value associated with a given key;
- * when applied to an array, accesses an element by index.
+ * when applied to an array, accesses an element by index.  json_object_size
+ * returns the number of members of an object.
  */
 
+size_t          json_object_size(const struct json *json);
 struct json    *json_object_get(const struct json *json, const uint8_t *key);
+struct json    *json_object_get_key(const struct json *json,
+                                    const struct json_key *key);
 struct json    *json_array_get(const struct json *json, size_t index);
 const uint8_t  *json_get_string(const struct json *json);
 double          json_get_number(const struct json *json);
 bool            json_get_boolean(const struct json *json);
 
+/**
+ * Iteration over object members.
+ *
+ * json_object_iter_begin positions a cursor before the first member of an
+ * object, and each call to json_object_iter_next returns the key, its length
+ * in bytes, and the value of the next member, in insertion order, until it
+ * returns false.  Any output pointer may be NULL.  Iteration takes constant
+ * time per member and allocates nothing.
+ *
+ * The member most recently returned may be removed without disturbing the
+ * cursor; removing any other member invalidates it.  Members added during
+ * iteration may or may not be visited.
+ */
+
+struct json_object_iter {
+    const void *member;
+};
+
+bool json_object_iter_begin(const struct json *json,
+                            struct json_object_iter *iter);
+bool json_object_iter_next(struct json_object_iter *iter, const uint8_t **key,
+                           size_t *length, struct json **value);
+
+/**
+ * Packed numeric arrays.
+ *
+ * Arrays consisting only of numbers are stored packed by the parser, as one
+ * contiguous block of doubles rather than one value per element, and
+ * json_array_pack packs an array built by other means; an empty array needs
+ * no packing, and it returns false only if an element is not a number or
+ * memory runs out.  For a packed or empty array, json_array_get_doubles
+ * stores the address and number of the doubles and returns true; it returns
+ * false for any other array.
+ *
+ * The doubles belong to the array.  json_array_get and json_pointer_get read
+ * an element without unpacking the array, returning a frozen value for it.
+ * Changing the array unpacks it, which invalidates the block, while packing
+ * an array releases its elements, so values previously read from it remain
+ * valid only where retained.
+ */
+
+bool json_array_pack(struct json *json);
+bool json_array_get_doubles(const struct json *json, const double **values,
+                            size_t *count);
+
+/**
+ * JSON Pointer (RFC 6901).
+ *
+ * json_pointer_compile parses a pointer such as "/a/b/0" once, so that it can
+ * be evaluated against any number of values without parsing it again.  It
+ * returns NULL if the pointer is malformed.  json_pointer_get returns the
+ * value the pointer refers to within `json`, or NULL if there is none; the
+ * empty pointer "" refers to `json` itself.
+ */
+
+struct json_pointer;
+
+struct json_pointer *json_pointer_compile(const uint8_t *text);
+void                 json_pointer_free(struct json_pointer *pointer);
+struct json         *json_pointer_get(const struct json *json,
+                                      const struct json_pointer *pointer);
+
+/**
+ * Patching values in place.
+ *
+ * json_merge_patch applies an RFC 7396 merge patch to `target`, and
+ * json_patch_apply applies the operations of an RFC 6902 patch, an array of
+ * objects such as {"op": "add", "path": "/a/0", "value": 1}.  Both modify the
+ * target where it is, through the object index and array splices, and copy
+ * only the values taken from the patch.  When the patch replaces the target
+ * itself, its contents are replaced in the same node.  The patch is not
+ * modified.
+ *
+ * Both return false if the patch cannot be applied, such as when a location
+ * does not exist, a test fails, or the target is frozen.  Operations are
+ * applied in order, and those before a failing operation remain applied.
+ */
+
+bool json_merge_patch(struct json *target, const struct json *patch);
+bool json_patch_apply(struct json *json, const struct json *ops);
+
+/**
+ * Returns a new RFC 6902 patch that turns `a` into `b` when applied with
+ * json_patch_apply, or NULL if memory runs out.  Identical subtrees are
+ * recognized by their hash and produce no operations; array elements are
+ * matched by hash so that insertions and removals do not shift the rest of
+ * the array into replacements.  Packed arrays are read without unpacking.
+ */
+
+struct json *json_diff(const struct json *a, const struct json *b);
+
+/**
+ * JSONPath queries.
+ *
+ * json_path_compile parses a query such as "$.store..book[?(@.price < 10)]"
+ * into a program, or returns NULL if it is malformed.  Queries start at the
+ * root `$` and use member names, `*`, array indexes and slices, filters
+ * comparing one relative path with a literal, or testing that it exists, and
+ * `..` for descendants at any depth.
+ *
+ * json_path_select calls `visit` with each value the query matches within
+ * `json`, in document order, and returns the number of matches; returning
+ * false from `visit` stops the query.  json_path_stream evaluates a query
+ * over the JSON text in a buffer without building the document.  Only
+ * matched values are created, and each is freed once `visit` returns.
+ * Queries that count from the end of an array cannot be streamed, and fail
+ * with JSON_INVALID_PATH.  If memory runs out, the query stops and status is
+ * set to JSON_OUT_OF_MEMORY; the matches visited until then are counted.
+ */
+
+struct json_path;
+
+struct json_path *json_path_compile(const uint8_t *text);
+void              json_path_free(struct json_path *path);
+size_t            json_path_select(const struct json *json,
+                                   const struct json_path *path,
+                                   bool (*visit)(void *context,
+                                                 const struct json *value),
+                                   void *context);
+size_t            json_path_stream(const uint8_t *buffer, size_t length,
+                                   const struct json_path *path,
+                                   bool (*visit)(void *context,
+                                                 const struct json *value),
+                                   void *context, enum json_status *status);
+
+/**
+ * Filtering record streams.
+ *
+ * json_predicate_compile parses a predicate such as
+ * `/level == "error" && /latency > 500`, or returns NULL if it is malformed.
+ * Each term compares the field named by a JSON Pointer with a JSON literal
+ * using ==, !=, <, <=, > or >=; only numbers and strings can be ordered.
+ * Terms are joined by && and ||, with && binding tighter.  A field that is
+ * missing or holds a value of another type is unequal to the literal and
+ * neither less nor greater.
+ *
+ * json_records_filter reads records from a buffer, either one value after
+ * another as in newline-delimited JSON, or the elements of a top-level
+ * array, and calls `visit` with each record the predicate accepts, or every
+ * record if it is NULL.  A record is valid only while `visit` runs, and
+ * returning false stops the filter.  Each term is decided as soon as its
+ * field is read, and the rest of a record is skipped once the outcome is
+ * known, so no values are created for rejected records and their remainder
+ * is only checked for balanced brackets.  Returns the number of records
+ * accepted, and sets status to the first error in the stream, or to
+ * JSON_OUT_OF_MEMORY if memory runs out.
+ */
+
+enum json_records {
+    JSON_RECORDS_LINES,
+    JSON_RECORDS_ARRAY
+};
+
+struct json_predicate;
+
+struct json_predicate *json_predicate_compile(const uint8_t *text);
+void                   json_predicate_free(struct json_predicate *predicate);
+size_t                 json_records_filter(const uint8_t *buffer, size_t length,
+                                           enum json_records layout,
+                                           const struct json_predicate *predicate,
+                                           bool (*visit)(void *context,
+                                                         const struct json *record),
+                                           void *context,
+                                           enum json_status *status);
+
+/**
+ * Aggregating record streams.
+ *
+ * json_aggregate_new creates an aggregate over the numeric fields named by
+ * `count` JSON Pointers, at most 63, grouped by the value at the `group`
+ * pointer unless it is NULL.  Groups are keyed by the text of a string or
+ * the JSON text of another scalar; records where the group field is missing
+ * or holds a container fall under "null".
+ *
+ * json_aggregate_records adds the records of a stream, read as by
+ * json_records_filter, without creating any value for them; once every
+ * field of a record has been read, the rest of it is skipped.  It may be
+ * called repeatedly to aggregate several buffers.  It returns false and sets
+ * status if the stream is invalid or memory runs out.
+ *
+ * json_aggregate_result returns a new object holding the number of records
+ * as "count" and, under each field's pointer, the "count", "sum", "min" and
+ * "max" of the numbers found there.  With a group field, the result has one
+ * such object per group, in order of first appearance.
+ */
+
+struct json_aggregate;
+
+struct json_aggregate *json_aggregate_new(const uint8_t *group,
+                                          const uint8_t *const *fields,
+                                          size_t count);
+void                   json_aggregate_free(struct json_aggregate *aggregate);
+bool                   json_aggregate_records(struct json_aggregate *aggregate,
+                                              const uint8_t *buffer, size_t length,
+                                              enum json_records layout,
+                                              enum json_status *status);
+struct json           *json_aggregate_result(const struct json_aggregate *aggregate);
+
 #endif // !JSON_H
@@ -8,6 +8,10 @@
  * Each production builds part of the syntax tree by invoking helper functions
  * from the JSON library to allocate and link values together. The completed
  * parse yields a structured `struct json` hierarchy suitable for traversal.
+ *
+ * When a projection is active, the actions report each key and array
+ * position before the value is scanned.  Values off the kept paths arrive
+ * from the lexer as a single SKIPPED token and produce no node.
  */
 
 %{
@@ -15,6 +19,7 @@
 
 #include "json.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -25,12 +30,31 @@ int yylex(void);
 struct json *json_root = NULL;
 void yyerror(const char *s);
 
+extern struct json_keys *json_parse_keys;
+bool json_object_add_in(struct json *json, const uint8_t *key,
+                        struct json *value, struct json_keys *keys);
+
+void json_project_root(void);
+void json_project_key(const uint8_t *key);
+void json_project_element(void);
+bool json_project_enter(void);
+void json_project_leave(void);
+
+static void
+add_member(struct json *object, uint8_t *key, struct json *value)
+{
+    if (value) json_object_add_in(object, key, value, json_parse_keys);
+    free(key);
+}
+
 %}
 
 %token <string>  STRING
 %token <number>  NUMBER
+%token <json>    NUMBERS
 %token <boolean> BOOLEAN
 %token NONE
+%token SKIPPED
 %token ERROR_TOKEN
 
 %union {
@@ -46,49 +70,65 @@ void yyerror(const char *s);
 
 %%
 
-json: value {
-        $$ = $1;
+json: { json_project_root(); } value {
+        $$ = $2;
         json_root = $$;
     };
 value
     : object    { $$ = $1; }
     | array     { $$ = $1; }
-    | STRING    { $$ = json_new_string($1);     }
+    | STRING    { $$ = json_new_string($1); free($1); }
     | NUMBER    { $$ = json_new_number($1);     }
+    | NUMBERS   { $$ = $1; if (!$$) YYABORT;    }
     | BOOLEAN   { $$ = json_new_boolean($1);    }
     | NONE      { $$ = json_new_null();         }
+    | SKIPPED   { $$ = NULL;                    }
     ;
 object
-    : '{' '}'  {
+    : object_begin '}'  {
+        json_project_leave();
         $$ = json_new_object();
     }
-    | '{' members '}' {
+    | object_begin members '}' {
+        json_project_leave();
         $$ = $2;
     };
+object_begin
+    : '{' {
+        if (!json_project_enter()) YYABORT;
+    };
 members
-    : STRING ':' value {
+    : STRING ':' { json_project_key($1); } value {
         $$ = json_new_object();
-        json_object_add($$, $1, $3);
+        add_member($$, $1, $4);
     }
-    | members ',' STRING ':' value {
+    | members ',' STRING ':' { json_project_key($3); } value {
         $$ = $1;
-        json_object_add($$, $3, $5);
+        add_member($$, $3, $6);
     };
 array
-    : '[' ']' {
+    : array_begin ']' {
+        json_project_leave();
         $$ = json_new_array();
     }
-    | '[' values ']' {
+    | array_begin values ']' {
+        json_project_leave();
         $$ = $2;
+        json_array_pack($$);
+    };
+array_begin
+    : '[' {
+        if (!json_project_enter()) YYABORT;
+        json_project_element();
     };
 values
     : value { 
         $$ = json_new_array();
-        json_array_add($$, $1);
+        if ($1) json_array_add($$, $1);
     }
-    | values ',' value {
+    | values ',' { json_project_element(); } value {
         $$ = $1;
-        json_array_add($$, $3);
+        if ($4) json_array_add($$, $4);
     };
 
 %%
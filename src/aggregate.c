@@ -0,0 +1,458 @@
+/**
+ * Aggregation over record streams.
+ *
+ * An aggregate counts records and, for each of a few fields, the count, sum,
+ * minimum and maximum of the numbers found there, optionally grouped by the
+ * value of another field.  Records are read with the in-memory reader, and
+ * only the lexemes at the requested fields are converted; once every field
+ * of a record has been reached, the rest of it is skipped.  Nothing is
+ * allocated per record, only when a new group appears.
+ *
+ * Groups are found through an open-addressing table keyed by the hash of the
+ * group value, and are kept in a list in order of first appearance, which is
+ * the order of the result.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define AGGREGATE_MAX_FIELDS 63
+#define AGGREGATE_TABLE_MIN  16
+
+struct aggregate_stats {
+    size_t count;
+    double sum;
+    double min;
+    double max;
+};
+
+struct aggregate_group {
+    struct aggregate_group *next;
+    uint8_t *key;
+    size_t length;
+    uint64_t hash;
+    size_t records;
+    struct aggregate_stats stats[];
+};
+
+struct json_aggregate {
+    size_t count;
+    bool grouped;
+    struct json_pointer *pointers[AGGREGATE_MAX_FIELDS + 1];
+    uint8_t *names[AGGREGATE_MAX_FIELDS];
+
+    struct aggregate_group *groups;
+    struct aggregate_group *last;
+    struct aggregate_group **table;
+    size_t slots;
+    size_t size;
+
+    /* The record being read. */
+    struct json_fields fields;
+    uint64_t seen;
+    uint64_t numbers;
+    double values[AGGREGATE_MAX_FIELDS];
+    const uint8_t *group;
+    size_t group_length;
+};
+
+/**
+ * The group field is followed as field `count`, after the aggregated ones.
+ */
+
+struct json_aggregate *
+json_aggregate_new(const uint8_t *group, const uint8_t *const *fields,
+                   size_t count)
+{
+    if (count > AGGREGATE_MAX_FIELDS) return NULL;
+
+    struct json_aggregate *aggregate = calloc(1, sizeof(*aggregate));
+    if (!aggregate) return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t length = strlen((const char *)fields[i]);
+        aggregate->pointers[i] = json_pointer_compile(fields[i]);
+        aggregate->names[i] = malloc(length + 1);
+        aggregate->count++;
+
+        if (!aggregate->pointers[i] || !aggregate->names[i]) {
+            json_aggregate_free(aggregate);
+            return NULL;
+        }
+        memcpy(aggregate->names[i], fields[i], length + 1);
+    }
+
+    if (group) {
+        aggregate->pointers[count] = json_pointer_compile(group);
+        if (!aggregate->pointers[count]) {
+            json_aggregate_free(aggregate);
+            return NULL;
+        }
+        aggregate->grouped = true;
+    }
+
+    size_t tracked = count + aggregate->grouped;
+    aggregate->fields.all = (tracked == 64) ? ~(uint64_t)0
+                                            : ((uint64_t)1 << tracked) - 1;
+    aggregate->fields.pointers = aggregate->pointers;
+    return aggregate;
+}
+
+void
+json_aggregate_free(struct json_aggregate *aggregate)
+{
+    if (!aggregate) return;
+
+    for (size_t i = 0; i < aggregate->count; i++) {
+        json_pointer_free(aggregate->pointers[i]);
+        free(aggregate->names[i]);
+    }
+    json_pointer_free(aggregate->pointers[aggregate->count]);
+
+    struct aggregate_group *group = aggregate->groups;
+    while (group) {
+        struct aggregate_group *next = group->next;
+        free(group->key);
+        free(group);
+        group = next;
+    }
+
+    free(aggregate->table);
+    free(aggregate->fields.decoded);
+    free(aggregate);
+}
+
+/**
+ * Groups.
+ */
+
+static bool
+table_grow(struct json_aggregate *aggregate)
+{
+    size_t slots = aggregate->slots ? aggregate->slots * 2 : AGGREGATE_TABLE_MIN;
+
+    struct aggregate_group **table = calloc(slots, sizeof(*table));
+    if (!table) return false;
+
+    for (struct aggregate_group *group = aggregate->groups; group; group = group->next) {
+        size_t slot = group->hash & (slots - 1);
+        while (table[slot]) slot = (slot + 1) & (slots - 1);
+        table[slot] = group;
+    }
+
+    free(aggregate->table);
+    aggregate->table = table;
+    aggregate->slots = slots;
+    return true;
+}
+
+static struct aggregate_group *
+group_find(struct json_aggregate *aggregate, const uint8_t *key, size_t length)
+{
+    uint64_t hash = json_hash_bytes(key, length);
+
+    if (aggregate->slots) {
+        size_t slot = hash & (aggregate->slots - 1);
+        for (struct aggregate_group *group; (group = aggregate->table[slot]);
+             slot = (slot + 1) & (aggregate->slots - 1)) {
+            if (group->hash == hash && group->length == length
+                && memcmp(group->key, key, length) == 0)
+                return group;
+        }
+    }
+
+    if (2 * (aggregate->size + 1) > aggregate->slots && !table_grow(aggregate))
+        return NULL;
+
+    struct aggregate_group *group =
+        calloc(1, sizeof(*group) + aggregate->count * sizeof(*group->stats));
+    if (!group) return NULL;
+
+    group->key = malloc(length + 1);
+    if (!group->key) {
+        free(group);
+        return NULL;
+    }
+    memcpy(group->key, key, length);
+    group->key[length] = '\0';
+    group->length = length;
+    group->hash = hash;
+
+    size_t slot = hash & (aggregate->slots - 1);
+    while (aggregate->table[slot]) slot = (slot + 1) & (aggregate->slots - 1);
+    aggregate->table[slot] = group;
+    aggregate->size++;
+
+    if (aggregate->last)
+        aggregate->last->next = group;
+    else
+        aggregate->groups = group;
+    aggregate->last = group;
+    return group;
+}
+
+/**
+ * Records are grouped by the text of a string, or the lexeme of any other
+ * scalar.  Records where the group field is missing or holds a container
+ * are grouped under "null".
+ */
+
+static bool
+record_add(struct json_aggregate *aggregate)
+{
+    const uint8_t *key = (const uint8_t *)"null";
+    size_t length = 4;
+    uint8_t *decoded = NULL;
+
+    if (!aggregate->grouped) {
+        length = 0;
+    }
+    else if (aggregate->group && *aggregate->group == '"') {
+        key = json_read_text(aggregate->group, aggregate->group_length,
+                             &length, &decoded);
+        if (!key) return false;
+    }
+    else if (aggregate->group) {
+        key = aggregate->group;
+        length = aggregate->group_length;
+    }
+
+    struct aggregate_group *group = group_find(aggregate, key, length);
+    free(decoded);
+    if (!group) return false;
+
+    group->records++;
+
+    uint64_t numbers = aggregate->numbers;
+    for (size_t i = 0; numbers; i++, numbers >>= 1) {
+        if (!(numbers & 1)) continue;
+
+        struct aggregate_stats *stats = &group->stats[i];
+        double value = aggregate->values[i];
+
+        if (stats->count == 0 || value < stats->min) stats->min = value;
+        if (stats->count == 0 || value > stats->max) stats->max = value;
+        stats->sum += value;
+        stats->count++;
+    }
+    return true;
+}
+
+/**
+ * Reading records.
+ */
+
+static uint64_t
+aggregate_value(struct json_aggregate *aggregate, const uint8_t *text,
+                size_t length, bool scalar)
+{
+    uint64_t ended;
+    uint64_t within = json_fields_enter(&aggregate->fields, &ended);
+
+    uint64_t bits = ended;
+    for (size_t i = 0; bits; i++, bits >>= 1) {
+        uint64_t bit = (uint64_t)1 << i;
+        if (!(bits & 1) || (aggregate->seen & bit)) continue;
+
+        aggregate->seen |= bit;
+        if (!scalar) continue;
+
+        if (i == aggregate->count) {
+            aggregate->group = text;
+            aggregate->group_length = length;
+        }
+        else if (*text == '-' || (*text >= '0' && *text <= '9')) {
+            aggregate->values[i] = json_read_number(text, length);
+            aggregate->numbers |= bit;
+        }
+    }
+    return within;
+}
+
+static bool
+aggregate_begin(void *context, const uint8_t *at)
+{
+    struct json_aggregate *aggregate = context;
+    struct json_fields *fields = &aggregate->fields;
+
+    uint64_t within = 0;
+    if (fields->depth == 0 || fields->frames[fields->depth].fields)
+        within = aggregate_value(aggregate, at, 1, false);
+
+    json_fields_open(fields, within, *at == '[');
+    return aggregate->seen != aggregate->fields.all;
+}
+
+static bool
+aggregate_end(void *context, const uint8_t *at)
+{
+    struct json_aggregate *aggregate = context;
+    (void)at;
+
+    aggregate->fields.depth--;
+    return true;
+}
+
+static bool
+aggregate_key(void *context, const uint8_t *text, size_t length)
+{
+    struct json_aggregate *aggregate = context;
+    return json_fields_key(&aggregate->fields, text, length);
+}
+
+static bool
+aggregate_scalar(void *context, const uint8_t *text, size_t length)
+{
+    struct json_aggregate *aggregate = context;
+
+    struct json_fields *fields = &aggregate->fields;
+    if (fields->depth == 0 || fields->frames[fields->depth].fields)
+        aggregate_value(aggregate, text, length, true);
+    return aggregate->seen != aggregate->fields.all;
+}
+
+static const struct json_events aggregate_events = {
+    .begin  = aggregate_begin,
+    .end    = aggregate_end,
+    .key    = aggregate_key,
+    .scalar = aggregate_scalar,
+};
+
+/**
+ * Reads one record and adds it.  Without an error in the text, the walk
+ * stops before every field is reached only if a key cannot be decoded.
+ */
+
+static bool
+record_read(struct json_aggregate *aggregate, struct json_reader *reader)
+{
+    aggregate->fields.depth = 0;
+    aggregate->seen = 0;
+    aggregate->numbers = 0;
+    aggregate->group = NULL;
+
+    if (!json_reader_walk(reader, &aggregate_events, aggregate)) {
+        if (aggregate->seen != aggregate->fields.all) {
+            if (reader->status == JSON_SUCCESS) reader->status = JSON_OUT_OF_MEMORY;
+            return false;
+        }
+        if (!json_reader_skip(reader, aggregate->fields.depth)) return false;
+    }
+
+    if (!record_add(aggregate)) {
+        reader->status = JSON_OUT_OF_MEMORY;
+        return false;
+    }
+    return true;
+}
+
+bool
+json_aggregate_records(struct json_aggregate *aggregate, const uint8_t *buffer,
+                       size_t length, enum json_records layout,
+                       enum json_status *status)
+{
+    struct json_record_stream stream;
+    json_records_init(&stream, buffer, length, layout);
+
+    bool valid = true;
+    while (valid && json_records_next(&stream))
+        valid = record_read(aggregate, &stream.reader);
+
+    if (valid && stream.reader.status != JSON_SUCCESS)
+        valid = false;
+
+    *status = valid ? JSON_SUCCESS : stream.reader.status;
+    return valid;
+}
+
+/**
+ * Results.
+ */
+
+static bool
+add_number(struct json *object, const char *key, double number)
+{
+    struct json *value = json_new_number(number);
+    if (value && json_object_add(object, (const uint8_t *)key, value))
+        return true;
+
+    json_free(value);
+    return false;
+}
+
+static bool
+add_value(struct json *object, const uint8_t *key, struct json *value)
+{
+    if (value && json_object_add(object, key, value))
+        return true;
+
+    json_free(value);
+    return false;
+}
+
+static struct json *
+stats_result(const struct aggregate_stats *stats)
+{
+    struct json *result = json_new_object();
+    if (!result) return NULL;
+
+    bool added = add_number(result, "count", (double)stats->count)
+              && add_number(result, "sum", stats->sum);
+    if (added && stats->count) {
+        added = add_number(result, "min", stats->min)
+             && add_number(result, "max", stats->max);
+    } else if (added) {
+        added = add_value(result, (const uint8_t *)"min", json_new_null())
+             && add_value(result, (const uint8_t *)"max", json_new_null());
+    }
+
+    if (!added) {
+        json_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+static struct json *
+group_result(const struct json_aggregate *aggregate,
+             const struct aggregate_group *group)
+{
+    static const struct aggregate_stats none = { 0 };
+
+    struct json *result = json_new_object();
+    if (!result) return NULL;
+
+    if (!add_number(result, "count", group ? (double)group->records : 0))
+        goto fail;
+
+    for (size_t i = 0; i < aggregate->count; i++) {
+        struct json *stats = stats_result(group ? &group->stats[i] : &none);
+        if (!add_value(result, aggregate->names[i], stats)) goto fail;
+    }
+    return result;
+
+fail:
+    json_free(result);
+    return NULL;
+}
+
+struct json *
+json_aggregate_result(const struct json_aggregate *aggregate)
+{
+    if (!aggregate) return NULL;
+    if (!aggregate->grouped) return group_result(aggregate, aggregate->groups);
+
+    struct json *result = json_new_object();
+    if (!result) return NULL;
+
+    for (const struct aggregate_group *group = aggregate->groups; group;
+         group = group->next) {
+        if (!add_value(result, group->key, group_result(aggregate, group))) {
+            json_free(result);
+            return NULL;
+        }
+    }
+    return result;
+}
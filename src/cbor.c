@@ -0,0 +1,631 @@
+/**
+ * CBOR (RFC 8949) encoding and decoding.
+ *
+ * Every item starts with a head: a major type in the top three bits of the
+ * first byte and an argument, stored in the low five bits when below 24 and
+ * otherwise in the 1, 2, 4, or 8 bytes that follow.  The argument is the
+ * value of an integer, the length of a string, or the number of elements or
+ * members of a container.
+ *
+ * Numbers are written as integers when they are integral and fit in 64 bits,
+ * and otherwise as the shortest float that holds them exactly, so no number
+ * is ever formatted or parsed as text.  Items with no JSON counterpart are
+ * read as RFC 8949 section 6.1 suggests: byte strings become base64url text,
+ * tags are ignored in favor of the item they enclose, and undefined, other
+ * simple values, and non-finite floats become null.
+ */
+
+#include "internal.h"
+#include "ustring.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CBOR_UNSIGNED   0
+#define CBOR_NEGATIVE   1
+#define CBOR_BYTES      2
+#define CBOR_TEXT       3
+#define CBOR_ARRAY      4
+#define CBOR_MAP        5
+#define CBOR_TAG        6
+#define CBOR_SIMPLE     7
+
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK      0xFF
+
+/**
+ * Half-precision floats.  A double converts only if it is exact in 16 bits:
+ * an 11-bit significand with an exponent from -14 to 15, or a multiple of
+ * 2^-24 below 2^-14.
+ */
+
+static bool
+half_from_double(double value, uint16_t *half)
+{
+    uint16_t sign = signbit(value) ? 0x8000 : 0;
+    double magnitude = fabs(value);
+
+    if (isnan(value)) {
+        *half = 0x7E00;
+        return true;
+    }
+    if (isinf(value) || magnitude == 0) {
+        *half = sign | (isinf(value) ? 0x7C00 : 0);
+        return true;
+    }
+
+    int exponent;
+    double fraction = frexp(magnitude, &exponent);
+    if (exponent > 16) return false;
+
+    if (exponent < -13) {
+        double units = ldexp(magnitude, 24);
+        if (units != (uint16_t)units) return false;
+        *half = sign | (uint16_t)units;
+        return true;
+    }
+
+    double significand = ldexp(fraction, 11);
+    if (significand != (uint16_t)significand) return false;
+    *half = sign | (uint16_t)((exponent + 14) << 10) | (uint16_t)(significand - 1024);
+    return true;
+}
+
+static double
+half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    double significand = half & 0x3FF;
+    double value;
+
+    if (exponent == 0)
+        value = ldexp(significand, -24);
+    else if (exponent < 31)
+        value = ldexp(significand + 1024, exponent - 25);
+    else
+        value = (significand == 0) ? INFINITY : NAN;
+
+    return (half & 0x8000) ? -value : value;
+}
+
+/**
+ * Encoding.
+ */
+
+static void
+write_head(FILE *out, int major, uint64_t argument)
+{
+    uint8_t head[9];
+    size_t size;
+
+    if (argument < 24) {
+        head[0] = (uint8_t)(major << 5 | argument);
+        size = 1;
+    } else if (argument <= UINT8_MAX) {
+        head[0] = (uint8_t)(major << 5 | 24);
+        size = 2;
+    } else if (argument <= UINT16_MAX) {
+        head[0] = (uint8_t)(major << 5 | 25);
+        size = 3;
+    } else if (argument <= UINT32_MAX) {
+        head[0] = (uint8_t)(major << 5 | 26);
+        size = 5;
+    } else {
+        head[0] = (uint8_t)(major << 5 | 27);
+        size = 9;
+    }
+
+    for (size_t i = size - 1; i > 0; i--, argument >>= 8)
+        head[i] = (uint8_t)argument;
+    fwrite(head, 1, size, out);
+}
+
+static void
+write_float(FILE *out, double number)
+{
+    uint16_t half;
+    uint8_t bytes[9];
+    size_t size;
+
+    if (half_from_double(number, &half)) {
+        bytes[0] = CBOR_SIMPLE << 5 | 25;
+        bytes[1] = (uint8_t)(half >> 8);
+        bytes[2] = (uint8_t)half;
+        size = 3;
+    } else if (fabs(number) <= 3.4028234663852886e38 && (double)(float)number == number) {
+        float single = (float)number;
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        bytes[0] = CBOR_SIMPLE << 5 | 26;
+        for (int i = 4; i > 0; i--, bits >>= 8) bytes[i] = (uint8_t)bits;
+        size = 5;
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        bytes[0] = CBOR_SIMPLE << 5 | 27;
+        for (int i = 8; i > 0; i--, bits >>= 8) bytes[i] = (uint8_t)bits;
+        size = 9;
+    }
+    fwrite(bytes, 1, size, out);
+}
+
+/**
+ * Integral numbers from -2^64 to 2^64 exclusive are written as integers,
+ * except negative zero, which only a float can hold.
+ */
+
+static void
+write_number(FILE *out, double number)
+{
+    if (number >= 0 && number < 18446744073709551616.0
+        && number == (uint64_t)number && !signbit(number)) {
+        write_head(out, CBOR_UNSIGNED, (uint64_t)number);
+        return;
+    }
+    if (number < 0 && number > -18446744073709551616.0
+        && -number == (uint64_t)-number) {
+        write_head(out, CBOR_NEGATIVE, (uint64_t)-number - 1);
+        return;
+    }
+    write_float(out, number);
+}
+
+static bool
+write_item(const struct json *json, FILE *out)
+{
+    if (!json_resolve(json)) return false;
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT: {
+            const struct json_object *object = json->data.object;
+            write_head(out, CBOR_MAP, object ? object->count : 0);
+
+            for (const struct json_member *member = object ? object->members : NULL;
+                 member; member = member->next) {
+                write_head(out, CBOR_TEXT, member->length);
+                fwrite(member->key, 1, member->length, out);
+                if (!write_item(member->value, out)) return false;
+            }
+            return true;
+        }
+        case JSON_TYPE_ARRAY:
+            if (json->tag & JSON_TAG_PACKED) {
+                const struct json_numbers *numbers = json->data.numbers;
+                write_head(out, CBOR_ARRAY, numbers->count);
+                for (size_t i = 0; i < numbers->count; i++)
+                    write_number(out, numbers->values[i]);
+            } else {
+                const struct json_array *array = json->data.array;
+                size_t count = array ? array->count : 0;
+                write_head(out, CBOR_ARRAY, count);
+                for (size_t i = 0; i < count; i++) {
+                    if (!write_item(array->items[i], out)) return false;
+                }
+            }
+            return true;
+        case JSON_TYPE_STRING: {
+            const uint8_t *text = json_string(json);
+            size_t length = strlen((const char *)text);
+            write_head(out, CBOR_TEXT, length);
+            fwrite(text, 1, length, out);
+            return true;
+        }
+        case JSON_TYPE_NUMBER:
+            write_number(out, json->data.number);
+            return true;
+        case JSON_TYPE_BOOLEAN:
+            write_head(out, CBOR_SIMPLE, json->data.boolean ? 21 : 20);
+            return true;
+        case JSON_TYPE_NULL:
+            write_head(out, CBOR_SIMPLE, 22);
+            return true;
+    }
+    return false;
+}
+
+bool
+json_to_cbor(const struct json *json, FILE *out)
+{
+    return json && write_item(json, out) && !ferror(out);
+}
+
+/**
+ * Decoding.
+ *
+ * Items are read straight from the buffer.  Text is checked for UTF-8 and
+ * copied once into its node, with no unescaping, and strings of up to
+ * JSON_INLINE_STRING bytes are stored in the node without an allocation.
+ * The element and member counts in container heads size arrays and object
+ * indexes before any element is read, and a definite-length array of
+ * numbers is decoded directly into packed storage.
+ */
+
+struct cbor_reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    enum json_status status;
+    size_t depth;
+};
+
+struct cbor_head {
+    int major;
+    int info;
+    uint64_t argument;
+};
+
+static bool
+read_fail(struct cbor_reader *reader, enum json_status status)
+{
+    if (reader->status == JSON_SUCCESS) reader->status = status;
+    return false;
+}
+
+static bool
+read_head(struct cbor_reader *reader, struct cbor_head *head)
+{
+    if (reader->p >= reader->end)
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+
+    uint8_t initial = *reader->p++;
+    head->major = initial >> 5;
+    head->info = initial & 0x1F;
+    head->argument = 0;
+
+    if (head->info < 24) {
+        head->argument = (uint64_t)head->info;
+        return true;
+    }
+    if (head->info == CBOR_INDEFINITE) {
+        if (head->major < CBOR_BYTES || head->major == CBOR_TAG)
+            return read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+        return true;
+    }
+    if (head->info > 27)
+        return read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+
+    size_t size = (size_t)1 << (head->info - 24);
+    if ((size_t)(reader->end - reader->p) < size)
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+
+    for (size_t i = 0; i < size; i++)
+        head->argument = head->argument << 8 | *reader->p++;
+    return true;
+}
+
+static bool
+at_break(struct cbor_reader *reader)
+{
+    if (reader->p < reader->end && *reader->p == CBOR_BREAK) {
+        reader->p++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Reads the bytes of a string whose head has been read.  A definite-length
+ * string is returned in place; the chunks of an indefinite-length one are
+ * joined in `*joined`, which the caller frees.
+ */
+
+static bool
+read_chunk(struct cbor_reader *reader, int major, uint64_t length,
+           const uint8_t **bytes)
+{
+    if (length > (uint64_t)(reader->end - reader->p))
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+
+    *bytes = reader->p;
+    reader->p += length;
+
+    if (major == CBOR_TEXT && !valid_UTF8(*bytes, reader->p))
+        return read_fail(reader, JSON_INVALID_UNICODE);
+    return true;
+}
+
+static bool
+read_bytes(struct cbor_reader *reader, const struct cbor_head *head,
+           const uint8_t **bytes, size_t *length, uint8_t **joined)
+{
+    *joined = NULL;
+
+    if (head->info != CBOR_INDEFINITE) {
+        *length = (size_t)head->argument;
+        return read_chunk(reader, head->major, head->argument, bytes);
+    }
+
+    size_t size = 0;
+    while (!at_break(reader)) {
+        struct cbor_head chunk;
+        const uint8_t *part;
+
+        if (!read_head(reader, &chunk)) goto fail;
+        if (chunk.major != head->major || chunk.info == CBOR_INDEFINITE) {
+            read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+            goto fail;
+        }
+        if (!read_chunk(reader, chunk.major, chunk.argument, &part)) goto fail;
+
+        uint8_t *resized = realloc(*joined, size + chunk.argument + 1);
+        if (!resized) goto fail;
+
+        *joined = resized;
+        memcpy(*joined + size, part, chunk.argument);
+        size += chunk.argument;
+    }
+
+    *bytes = *joined ? *joined : (const uint8_t *)"";
+    *length = size;
+    return true;
+
+fail:
+    free(*joined);
+    *joined = NULL;
+    return false;
+}
+
+static struct json *read_item(struct cbor_reader *reader);
+
+/**
+ * Reads a number item if one comes next, without consuming anything or
+ * failing otherwise.  Non-finite floats are not numbers in JSON.
+ */
+
+static bool
+read_number(struct cbor_reader *reader, double *number)
+{
+    const uint8_t *start = reader->p;
+    enum json_status status = reader->status;
+    struct cbor_head head;
+
+    if (reader->p < reader->end && *reader->p >> 5 <= CBOR_NEGATIVE) {
+        if (!read_head(reader, &head)) goto none;
+        *number = (head.major == CBOR_UNSIGNED) ? (double)head.argument
+                                                : -1.0 - (double)head.argument;
+        return true;
+    }
+
+    if (reader->p < reader->end && *reader->p >> 5 == CBOR_SIMPLE
+        && (*reader->p & 0x1F) >= 25 && (*reader->p & 0x1F) <= 27) {
+        if (!read_head(reader, &head)) goto none;
+
+        if (head.info == 25) {
+            *number = half_to_double((uint16_t)head.argument);
+        } else if (head.info == 26) {
+            uint32_t bits = (uint32_t)head.argument;
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            *number = single;
+        } else {
+            memcpy(number, &head.argument, sizeof(*number));
+        }
+        if (isfinite(*number)) return true;
+    }
+
+none:
+    reader->p = start;
+    reader->status = status;
+    return false;
+}
+
+static bool
+read_array(struct cbor_reader *reader, struct json *array,
+           const struct cbor_head *head)
+{
+    if (head->info == CBOR_INDEFINITE) {
+        while (!at_break(reader)) {
+            struct json *item = read_item(reader);
+            if (!item) return false;
+            if (!json_array_add(array, item)) {
+                json_free(item);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t count = head->argument;
+    if (count > (uint64_t)(reader->end - reader->p))
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+    if (count == 0) return true;
+
+    struct json_numbers *numbers = json_numbers_new(count);
+    if (!numbers) return false;
+
+    size_t read = 0;
+    while (read < count && read_number(reader, &numbers->values[read])) read++;
+
+    if (read == count) {
+        numbers->count = count;
+        array->data.numbers = numbers;
+        array->tag |= JSON_TAG_PACKED;
+        return true;
+    }
+
+    bool done = json_array_reserve(array, count);
+    for (size_t i = 0; i < read && done; i++) {
+        struct json *item = json_new_number(numbers->values[i]);
+        done = item && json_array_add(array, item);
+        if (item && !done) json_free(item);
+    }
+    free(numbers);
+
+    for (size_t i = read; i < count && done; i++) {
+        struct json *item = read_item(reader);
+        done = item && json_array_add(array, item);
+        if (item && !done) json_free(item);
+    }
+    return done;
+}
+
+/**
+ * Keys must be text.  A repeated key replaces the earlier value, as it does
+ * when parsing text.
+ */
+
+static bool
+read_member(struct cbor_reader *reader, struct json *object)
+{
+    struct cbor_head head;
+    if (!read_head(reader, &head)) return false;
+    if (head.major != CBOR_TEXT)
+        return read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+
+    const uint8_t *key;
+    size_t length;
+    uint8_t *joined;
+    if (!read_bytes(reader, &head, &key, &length, &joined)) return false;
+
+    struct json *value = read_item(reader);
+    struct json_member *member =
+        value ? json_member_make(key, length, value, NULL) : NULL;
+    free(joined);
+
+    if (!member) {
+        json_free(value);
+        return false;
+    }
+
+    struct json_member *existing =
+        json_object_find(object->data.object, member->key, member->hash);
+    if (existing) {
+        json_free(existing->value);
+        existing->value = member->value;
+        member->value = NULL;
+        json_member_free(member);
+        return true;
+    }
+
+    if (!json_object_append(object, member)) {
+        json_member_free(member);
+        return false;
+    }
+    return true;
+}
+
+static bool
+read_map(struct cbor_reader *reader, struct json *object,
+         const struct cbor_head *head)
+{
+    if (head->info == CBOR_INDEFINITE) {
+        while (!at_break(reader)) {
+            if (!read_member(reader, object)) return false;
+        }
+        return true;
+    }
+
+    if (head->argument > (uint64_t)(reader->end - reader->p) / 2)
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+    if (!json_object_reserve(object, (size_t)head->argument)) return false;
+
+    for (uint64_t i = 0; i < head->argument; i++) {
+        if (!read_member(reader, object)) return false;
+    }
+    return true;
+}
+
+/**
+ * Finite floats are read as numbers before the head is; any other simple
+ * value that reaches here is a boolean, a null, or has no JSON counterpart.
+ */
+
+static struct json *
+read_simple(struct cbor_reader *reader, const struct cbor_head *head)
+{
+    switch (head->info) {
+        case 20:
+        case 21:
+            return json_new_boolean(head->info == 21);
+        case CBOR_INDEFINITE:
+            read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+            return NULL;
+        default:
+            return json_new_null();
+    }
+}
+
+static struct json *
+read_container(struct cbor_reader *reader, const struct cbor_head *head)
+{
+    if (reader->depth >= JSON_MAX_DEPTH) {
+        read_fail(reader, JSON_NESTING_TOO_DEEP);
+        return NULL;
+    }
+
+    bool map = (head->major == CBOR_MAP);
+    struct json *result = json_new_value(map ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY);
+    if (!result) return NULL;
+
+    reader->depth++;
+    bool done = map ? read_map(reader, result, head) : read_array(reader, result, head);
+    reader->depth--;
+
+    if (!done) {
+        json_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+static struct json *
+read_item(struct cbor_reader *reader)
+{
+    double number;
+    struct cbor_head head;
+
+    for (;;) {
+        if (read_number(reader, &number)) return json_new_number(number);
+        if (!read_head(reader, &head)) return NULL;
+        if (head.major != CBOR_TAG) break;
+    }
+
+    switch (head.major) {
+        case CBOR_BYTES:
+        case CBOR_TEXT: {
+            const uint8_t *bytes;
+            size_t length;
+            uint8_t *joined;
+            if (!read_bytes(reader, &head, &bytes, &length, &joined)) return NULL;
+
+            struct json *result = json_new_value(JSON_TYPE_STRING);
+            bool set = result && ((head.major == CBOR_TEXT)
+                                  ? json_set_string(result, bytes, length)
+                                  : json_set_base64url(result, bytes, length));
+            free(joined);
+            if (!set) {
+                free(result);
+                return NULL;
+            }
+            return result;
+        }
+        case CBOR_ARRAY:
+        case CBOR_MAP:
+            return read_container(reader, &head);
+        case CBOR_SIMPLE:
+            return read_simple(reader, &head);
+        default:
+            read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+            return NULL;
+    }
+}
+
+struct json *
+json_from_cbor(const uint8_t *buffer, size_t length, enum json_status *status)
+{
+    struct cbor_reader reader = { buffer, buffer + length, JSON_SUCCESS, 0 };
+
+    struct json *result = read_item(&reader);
+    if (result && reader.p != reader.end) {
+        read_fail(&reader, JSON_UNEXPECTED_CHARACTER);
+        json_free(result);
+        result = NULL;
+    }
+
+    /* Reading fails without a status only when an allocation does. */
+    if (!result && reader.status == JSON_SUCCESS)
+        reader.status = JSON_OUT_OF_MEMORY;
+
+    if (status) *status = reader.status;
+    return result;
+}
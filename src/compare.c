@@ -0,0 +1,271 @@
+/**
+ * Structural equality and hashing of JSON values.
+ *
+ * Two values are equal if they have the same type and contents.  Numbers are
+ * compared by value, so `1`, `1.0` and `10e-1` are equal, and so are `0` and
+ * `-0`.  Arrays are equal element by element, in order, whether or not they
+ * are packed.  Objects are equal if they have the same keys with equal
+ * values, in any order; each member is looked up in the other object through
+ * its index, so objects are compared in linear time.
+ *
+ * The hash is consistent with equality and does not depend on the process,
+ * so it may be stored.  Member hashes are combined by addition, which does
+ * not depend on their order.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_OBJECT  0x9E3779B97F4A7C15ULL
+#define HASH_ARRAY   0xC2B2AE3D27D4EB4FULL
+#define HASH_STRING  0x165667B19E3779F9ULL
+#define HASH_NUMBER  0xD6E8FEB86659FD93ULL
+#define HASH_TRUE    0xA0761D6478BD642FULL
+#define HASH_FALSE   0xE7037ED1A0B428DBULL
+#define HASH_NULL    0x8EBC6AF09C88C6E3ULL
+
+static uint64_t
+mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static size_t
+array_size(const struct json *json)
+{
+    if (json->tag & JSON_TAG_PACKED) return json->data.numbers->count;
+    return json->data.array ? json->data.array->count : 0;
+}
+
+static bool
+number_matches(const struct json *json, double number)
+{
+    return json_kind(json) == JSON_TYPE_NUMBER && json_resolve(json)
+        && json->data.number == number;
+}
+
+/**
+ * Equality.
+ */
+
+static bool
+arrays_equal(const struct json *a, const struct json *b)
+{
+    size_t count = array_size(a);
+    if (array_size(b) != count) return false;
+
+    if (!(a->tag & JSON_TAG_PACKED) && (b->tag & JSON_TAG_PACKED)) {
+        const struct json *swap = a;
+        a = b;
+        b = swap;
+    }
+
+    if (a->tag & JSON_TAG_PACKED) {
+        const double *numbers = a->data.numbers->values;
+
+        for (size_t i = 0; i < count; i++) {
+            bool equal = (b->tag & JSON_TAG_PACKED)
+                       ? b->data.numbers->values[i] == numbers[i]
+                       : number_matches(b->data.array->items[i], numbers[i]);
+            if (!equal) return false;
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!json_equal(a->data.array->items[i], b->data.array->items[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool
+objects_equal(const struct json_object *a, const struct json_object *b)
+{
+    size_t count = a ? a->count : 0;
+    if ((b ? b->count : 0) != count) return false;
+    if (!count) return true;
+
+    for (const struct json_member *member = a->members; member;
+         member = member->next) {
+        const struct json_member *other =
+            json_object_find(b, member->key, member->hash);
+        if (!other || !json_equal(member->value, other->value))
+            return false;
+    }
+    return true;
+}
+
+bool
+json_equal(const struct json *a, const struct json *b)
+{
+    if (a == b) return true;
+    if (!a || !b) return false;
+    if (json_kind(a) != json_kind(b)) return false;
+    if (!json_resolve(a) || !json_resolve(b)) return false;
+
+    switch (json_kind(a)) {
+        case JSON_TYPE_OBJECT:
+            return objects_equal(a->data.object, b->data.object);
+        case JSON_TYPE_ARRAY:
+            return arrays_equal(a, b);
+        case JSON_TYPE_STRING:
+            return strcmp((const char *)json_string(a),
+                          (const char *)json_string(b)) == 0;
+        case JSON_TYPE_NUMBER:
+            return a->data.number == b->data.number;
+        case JSON_TYPE_BOOLEAN:
+            return a->data.boolean == b->data.boolean;
+        case JSON_TYPE_NULL:
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Hashing.
+ */
+
+static uint64_t
+hash_number(double number)
+{
+    if (number == 0) number = 0;
+
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return mix(HASH_NUMBER ^ bits);
+}
+
+/**
+ * A cache remembers the hash of each container it has seen, so that hashing
+ * every subtree of a tree, as a diff does, costs one pass over the tree.
+ */
+
+static uint64_t *
+cache_slot(struct json_hash_cache *cache, const struct json *json)
+{
+    size_t mask = cache->slots - 1;
+    size_t slot = mix((uint64_t)(uintptr_t)json) & mask;
+
+    while (cache->nodes[slot] && cache->nodes[slot] != json)
+        slot = (slot + 1) & mask;
+    return &cache->hashes[slot];
+}
+
+static bool
+cache_grow(struct json_hash_cache *cache)
+{
+    size_t slots = cache->slots ? cache->slots * 2 : 64;
+
+    struct json_hash_cache grown = { 0 };
+    grown.nodes = calloc(slots, sizeof(*grown.nodes));
+    grown.hashes = calloc(slots, sizeof(*grown.hashes));
+    grown.slots = slots;
+    if (!grown.nodes || !grown.hashes) {
+        json_hash_cache_free(&grown);
+        return false;
+    }
+
+    for (size_t i = 0; i < cache->slots; i++) {
+        if (!cache->nodes[i]) continue;
+
+        uint64_t *hash = cache_slot(&grown, cache->nodes[i]);
+        *hash = cache->hashes[i];
+        grown.nodes[hash - grown.hashes] = cache->nodes[i];
+    }
+
+    grown.size = cache->size;
+    json_hash_cache_free(cache);
+    *cache = grown;
+    return true;
+}
+
+static uint64_t
+hash_value(const struct json *json, struct json_hash_cache *cache)
+{
+    if (!json || !json_resolve(json)) return 0;
+
+    enum json_type type = json_kind(json);
+    bool container = (type == JSON_TYPE_OBJECT || type == JSON_TYPE_ARRAY);
+
+    if (cache && container && cache->slots) {
+        uint64_t *hash = cache_slot(cache, json);
+        if (cache->nodes[hash - cache->hashes]) return *hash;
+    }
+
+    uint64_t hash;
+    switch (type) {
+        case JSON_TYPE_OBJECT:
+            hash = HASH_OBJECT;
+            if (json->data.object) {
+                for (const struct json_member *member = json->data.object->members;
+                     member; member = member->next)
+                    hash += mix(member->hash ^ mix(hash_value(member->value, cache)));
+            }
+            hash = mix(hash);
+            break;
+        case JSON_TYPE_ARRAY: {
+            size_t count = array_size(json);
+            hash = HASH_ARRAY;
+
+            for (size_t i = 0; i < count; i++) {
+                uint64_t item = (json->tag & JSON_TAG_PACKED)
+                              ? hash_number(json->data.numbers->values[i])
+                              : hash_value(json->data.array->items[i], cache);
+                hash = mix(hash ^ item);
+            }
+            hash = mix(hash + count);
+            break;
+        }
+        case JSON_TYPE_STRING: {
+            const uint8_t *string = json_string(json);
+            return mix(HASH_STRING ^ json_hash_bytes(string, strlen((const char *)string)));
+        }
+        case JSON_TYPE_NUMBER:
+            return hash_number(json->data.number);
+        case JSON_TYPE_BOOLEAN:
+            return json->data.boolean ? HASH_TRUE : HASH_FALSE;
+        case JSON_TYPE_NULL:
+            return HASH_NULL;
+        default:
+            return 0;
+    }
+
+    if (cache && (2 * (cache->size + 1) <= cache->slots || cache_grow(cache))) {
+        uint64_t *slot = cache_slot(cache, json);
+        cache->nodes[slot - cache->hashes] = json;
+        *slot = hash;
+        cache->size++;
+    }
+    return hash;
+}
+
+uint64_t
+json_hash(const struct json *json)
+{
+    return hash_value(json, NULL);
+}
+
+uint64_t
+json_hash_cached(const struct json *json, struct json_hash_cache *cache)
+{
+    return hash_value(json, cache);
+}
+
+void
+json_hash_cache_free(struct json_hash_cache *cache)
+{
+    free(cache->nodes);
+    free(cache->hashes);
+    cache->nodes = NULL;
+    cache->hashes = NULL;
+    cache->slots = 0;
+    cache->size = 0;
+}
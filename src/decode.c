@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 bool
@@ -133,3 +134,30 @@ decode_next_UTF8(const uint8_t **ptr, const uint8_t *end, uint32_t *out)
     }
 }
 
+
+/**
+ * Checks that a whole buffer is well-formed UTF-8, skipping runs of ASCII
+ * eight bytes at a time.
+ */
+
+bool
+valid_UTF8(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            if (!(word & 0x8080808080808080ULL)) {
+                p += 8;
+                continue;
+            }
+        }
+        if (*p < 0x80) {
+            p++;
+            continue;
+        }
+        uint32_t code;
+        if (!decode_next_UTF8(&p, end, &code)) return false;
+    }
+    return true;
+}
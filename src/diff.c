@@ -0,0 +1,317 @@
+/**
+ * Structural diff producing JSON Patch (RFC 6902).
+ *
+ * Subtrees are compared by hash first.  The hash of every container is
+ * computed once, in a cache, so unequal branches are told apart in constant
+ * time; branches with equal hashes are confirmed equal and skipped without
+ * emitting anything.  Objects are matched member by member through the index
+ * of the other object, in linear time.  Arrays are aligned by a longest
+ * common subsequence of their element hashes, after trimming the common
+ * prefix and suffix; elements left unmatched on both sides at the same place
+ * are diffed in turn.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Arrays whose unmatched middles would need a larger table than this are
+ * compared position by position instead.
+ */
+
+#define DIFF_MAX_CELLS ((size_t)1 << 22)
+
+struct diff {
+    struct json *patch;
+    struct json_hash_cache cache;
+
+    uint8_t *path;
+    size_t length;
+    size_t capacity;
+};
+
+/**
+ * Paths.
+ */
+
+static bool
+path_reserve(struct diff *diff, size_t extra)
+{
+    if (diff->length + extra + 1 <= diff->capacity) return true;
+
+    size_t capacity = diff->capacity ? diff->capacity : 64;
+    while (capacity < diff->length + extra + 1) capacity *= 2;
+
+    uint8_t *path = realloc(diff->path, capacity);
+    if (!path) return false;
+
+    diff->path = path;
+    diff->capacity = capacity;
+    return true;
+}
+
+static bool
+path_push_key(struct diff *diff, const uint8_t *key, size_t length)
+{
+    if (!path_reserve(diff, 2 * length + 1)) return false;
+
+    diff->path[diff->length++] = '/';
+    for (size_t i = 0; i < length; i++) {
+        if (key[i] == '~' || key[i] == '/') {
+            diff->path[diff->length++] = '~';
+            diff->path[diff->length++] = (key[i] == '~') ? '0' : '1';
+        } else {
+            diff->path[diff->length++] = key[i];
+        }
+    }
+    diff->path[diff->length] = '\0';
+    return true;
+}
+
+static bool
+path_push_index(struct diff *diff, size_t index)
+{
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%zu", index);
+    return path_push_key(diff, (const uint8_t *)digits, (size_t)length);
+}
+
+static void
+path_pop(struct diff *diff, size_t length)
+{
+    diff->length = length;
+    diff->path[length] = '\0';
+}
+
+/**
+ * Operations.  Values are copied into the patch, which does not refer to
+ * either input.
+ */
+
+static bool
+emit(struct diff *diff, const char *kind, const struct json *value)
+{
+    struct json *op = json_new_object();
+    if (!op) return false;
+
+    struct json *name = json_new_string((const uint8_t *)kind);
+    struct json *path = json_new_string(diff->path);
+    struct json *copy = value ? json_clone(value) : NULL;
+
+    bool built = name && json_object_add(op, (const uint8_t *)"op", name);
+    if (!built) json_free(name);
+    built = built && path && json_object_add(op, (const uint8_t *)"path", path);
+    if (!built) json_free(path);
+    if (value) {
+        built = built && copy && json_object_add(op, (const uint8_t *)"value", copy);
+        if (!built) json_free(copy);
+    }
+
+    if (!built || !json_array_add(diff->patch, op)) {
+        json_free(op);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Comparing values.
+ */
+
+static bool diff_value(struct diff *diff, const struct json *a, const struct json *b);
+
+static bool
+same(struct diff *diff, const struct json *a, const struct json *b)
+{
+    return json_hash_cached(a, &diff->cache) == json_hash_cached(b, &diff->cache)
+        && json_equal(a, b);
+}
+
+static bool
+diff_object(struct diff *diff, const struct json *a, const struct json *b)
+{
+    size_t length = diff->length;
+    struct json_object_iter iter;
+    const uint8_t *key;
+    size_t size;
+    struct json *value;
+
+    json_object_iter_begin(a, &iter);
+    while (json_object_iter_next(&iter, &key, &size, &value)) {
+        struct json *other = json_object_get(b, key);
+        if (!path_push_key(diff, key, size)) return false;
+
+        bool done = other ? diff_value(diff, value, other) : emit(diff, "remove", NULL);
+        path_pop(diff, length);
+        if (!done) return false;
+    }
+
+    json_object_iter_begin(b, &iter);
+    while (json_object_iter_next(&iter, &key, &size, &value)) {
+        if (json_object_get(a, key)) continue;
+        if (!path_push_key(diff, key, size)) return false;
+
+        bool done = emit(diff, "add", value);
+        path_pop(diff, length);
+        if (!done) return false;
+    }
+    return true;
+}
+
+/**
+ * Emits the edit at `index` of the array being patched, where elements
+ * before it already equal those of the target.
+ */
+
+static bool
+diff_element(struct diff *diff, size_t index, const char *kind,
+             const struct json *a, const struct json *b)
+{
+    size_t length = diff->length;
+    if (!path_push_index(diff, index)) return false;
+
+    bool done = a ? diff_value(diff, a, b) : emit(diff, kind, b);
+    path_pop(diff, length);
+    return done;
+}
+
+/**
+ * Aligns the middles a[start..n) and b[start..m) through a table of common
+ * subsequence lengths of their suffixes, then walks it from the front.
+ * Elements skipped on both sides at once are diffed against each other,
+ * which turns a removal and an addition into a finer change.
+ */
+
+static bool
+diff_middle(struct diff *diff, const struct json *a, const struct json *b,
+            size_t start, size_t n, size_t m)
+{
+    size_t rows = n - start, columns = m - start;
+    if (rows == 0 && columns == 0) return true;
+
+    uint64_t *hashes = malloc((rows + columns) * sizeof(*hashes));
+    uint32_t *table = calloc((rows + 1) * (columns + 1), sizeof(*table));
+    if (!hashes || !table) {
+        free(hashes);
+        free(table);
+        return false;
+    }
+
+    for (size_t i = 0; i < rows; i++)
+        hashes[i] = json_hash_cached(json_array_get(a, start + i), &diff->cache);
+    for (size_t j = 0; j < columns; j++)
+        hashes[rows + j] = json_hash_cached(json_array_get(b, start + j), &diff->cache);
+
+#define LCS(i, j) table[(i) * (columns + 1) + (j)]
+    for (size_t i = rows; i-- > 0;) {
+        for (size_t j = columns; j-- > 0;) {
+            if (hashes[i] == hashes[rows + j])
+                LCS(i, j) = LCS(i + 1, j + 1) + 1;
+            else
+                LCS(i, j) = (LCS(i + 1, j) > LCS(i, j + 1)) ? LCS(i + 1, j) : LCS(i, j + 1);
+        }
+    }
+
+    bool done = true;
+    size_t i = 0, j = 0, index = start;
+
+    while (done && (i < rows || j < columns)) {
+        const struct json *x = (i < rows) ? json_array_get(a, start + i) : NULL;
+        const struct json *y = (j < columns) ? json_array_get(b, start + j) : NULL;
+
+        if (x && y && hashes[i] == hashes[rows + j] && json_equal(x, y)) {
+            i++, j++, index++;
+        }
+        else if (x && y && LCS(i + 1, j + 1) == LCS(i, j)) {
+            done = diff_element(diff, index++, NULL, x, y);
+            i++, j++;
+        }
+        else if (x && (!y || LCS(i + 1, j) >= LCS(i, j + 1))) {
+            done = diff_element(diff, index, "remove", NULL, NULL);
+            i++;
+        }
+        else {
+            done = diff_element(diff, index++, "add", NULL, y);
+            j++;
+        }
+    }
+#undef LCS
+
+    free(hashes);
+    free(table);
+    return done;
+}
+
+static bool
+diff_array(struct diff *diff, const struct json *a, const struct json *b)
+{
+    size_t n = json_array_length(a), m = json_array_length(b);
+
+    size_t start = 0;
+    while (start < n && start < m
+           && same(diff, json_array_get(a, start), json_array_get(b, start)))
+        start++;
+
+    while (n > start && m > start
+           && same(diff, json_array_get(a, n - 1), json_array_get(b, m - 1)))
+        n--, m--;
+
+    if ((n - start + 1) * (m - start + 1) <= DIFF_MAX_CELLS)
+        return diff_middle(diff, a, b, start, n, m);
+
+    size_t index = start;
+    for (; index < n && index < m; index++) {
+        if (!diff_element(diff, index, NULL, json_array_get(a, index),
+                          json_array_get(b, index)))
+            return false;
+    }
+    for (size_t i = index; i < n; i++) {
+        if (!diff_element(diff, index, "remove", NULL, NULL)) return false;
+    }
+    for (; index < m; index++) {
+        if (!diff_element(diff, index, "add", NULL, json_array_get(b, index)))
+            return false;
+    }
+    return true;
+}
+
+static bool
+diff_value(struct diff *diff, const struct json *a, const struct json *b)
+{
+    if (same(diff, a, b)) return true;
+
+    enum json_type type = json_type(a);
+    if (type != json_type(b)) return emit(diff, "replace", b);
+
+    switch (type) {
+        case JSON_TYPE_OBJECT: return diff_object(diff, a, b);
+        case JSON_TYPE_ARRAY:  return diff_array(diff, a, b);
+        default:               return emit(diff, "replace", b);
+    }
+}
+
+struct json *
+json_diff(const struct json *a, const struct json *b)
+{
+    if (!a || !b) return NULL;
+
+    struct diff diff = { 0 };
+    diff.patch = json_new_array();
+    if (!diff.patch || !path_reserve(&diff, 0)) {
+        json_free(diff.patch);
+        return NULL;
+    }
+    diff.path[0] = '\0';
+
+    bool done = diff_value(&diff, a, b);
+
+    json_hash_cache_free(&diff.cache);
+    free(diff.path);
+    if (!done) {
+        json_free(diff.patch);
+        return NULL;
+    }
+    return diff.patch;
+}
@@ -0,0 +1,366 @@
+/**
+ * On-demand access to JSON documents held in memory.
+ *
+ * Opening a document walks the text once to validate it and to record an
+ * index entry for every key and value.  Values are then created lazily: the
+ * root starts out pending, and expanding a pending container creates pending
+ * nodes for its children without looking inside them.  Strings are unescaped
+ * and numbers converted only when they are expanded themselves.  Keys are
+ * interned in a pool owned by the document, so records of the same shape
+ * share their keys.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Index entry for a key or value.
+ *
+ * `offset` is the position of the first byte of the lexeme in the buffer.
+ * For scalars and keys, `span` is the length of the lexeme; for containers,
+ * it is the number of index entries in the subtree, including the container
+ * itself, so that the next sibling is found without visiting the subtree.
+ */
+
+struct json_doc_entry {
+    size_t offset;
+    size_t span;
+};
+
+struct json_doc {
+    const uint8_t *buffer;
+    size_t length;
+
+    struct json_doc_entry *entries;
+    size_t count;
+    size_t capacity;
+
+    struct json *root;
+    struct json_keys *keys;
+};
+
+static bool
+is_container(const struct json_doc *doc, size_t entry)
+{
+    uint8_t c = doc->buffer[doc->entries[entry].offset];
+    return c == '{' || c == '[';
+}
+
+static size_t
+next_entry(const struct json_doc *doc, size_t entry)
+{
+    return is_container(doc, entry) ? entry + doc->entries[entry].span
+                                    : entry + 1;
+}
+
+/**
+ * Building the index.
+ *
+ * The reader reports each key, scalar, and bracket in document order.  Open
+ * containers are kept on a stack so that their span can be filled in when
+ * the closing bracket is reached.
+ */
+
+struct doc_builder {
+    struct json_doc *doc;
+    size_t depth;
+    size_t open[JSON_MAX_DEPTH];
+};
+
+static bool
+doc_append(struct json_doc *doc, size_t offset, size_t span)
+{
+    if (doc->count == UINT32_MAX) return false;
+
+    if (doc->count == doc->capacity) {
+        size_t request = doc->capacity ? doc->capacity * 2 : 64;
+        void *resized = realloc(doc->entries, request * sizeof(*doc->entries));
+        if (!resized) return false;
+
+        doc->entries = resized;
+        doc->capacity = request;
+    }
+
+    doc->entries[doc->count].offset = offset;
+    doc->entries[doc->count].span = span;
+    doc->count++;
+    return true;
+}
+
+static bool
+on_begin(void *context, const uint8_t *at)
+{
+    struct doc_builder *builder = context;
+    struct json_doc *doc = builder->doc;
+
+    builder->open[builder->depth++] = doc->count;
+    return doc_append(doc, at - doc->buffer, 0);
+}
+
+static bool
+on_end(void *context, const uint8_t *at)
+{
+    struct doc_builder *builder = context;
+    struct json_doc *doc = builder->doc;
+    (void)at;
+
+    size_t entry = builder->open[--builder->depth];
+    doc->entries[entry].span = doc->count - entry;
+    return true;
+}
+
+static bool
+on_lexeme(void *context, const uint8_t *text, size_t length)
+{
+    struct doc_builder *builder = context;
+    struct json_doc *doc = builder->doc;
+
+    return doc_append(doc, text - doc->buffer, length);
+}
+
+static const struct json_events doc_events = {
+    .begin  = on_begin,
+    .end    = on_end,
+    .key    = on_lexeme,
+    .scalar = on_lexeme,
+};
+
+/**
+ * Creates the node for an index entry.  Literals are created complete; all
+ * other values are left pending until they are accessed.
+ */
+
+static struct json *
+doc_node(struct json_doc *doc, size_t entry)
+{
+    switch (doc->buffer[doc->entries[entry].offset]) {
+        case 't': return json_new_boolean(true);
+        case 'f': return json_new_boolean(false);
+        case 'n': return json_new_null();
+    }
+
+    enum json_type type;
+    switch (doc->buffer[doc->entries[entry].offset]) {
+        case '{': type = JSON_TYPE_OBJECT; break;
+        case '[': type = JSON_TYPE_ARRAY;  break;
+        case '"': type = JSON_TYPE_STRING; break;
+        default:  type = JSON_TYPE_NUMBER; break;
+    }
+
+    struct json *result = json_new_value(type);
+    if (!result) return NULL;
+
+    result->tag |= JSON_TAG_PENDING;
+    result->aux = (uint32_t)entry;
+    result->data.doc = doc;
+    return result;
+}
+
+struct json_doc *
+json_doc_open(const uint8_t *buffer, size_t length, enum json_status *status)
+{
+    *status = JSON_OUT_OF_MEMORY;
+
+    struct json_doc *doc = calloc(1, sizeof(*doc));
+    if (!doc) return NULL;
+
+    doc->buffer = buffer;
+    doc->length = length;
+
+    doc->keys = json_keys_new();
+    if (!doc->keys) {
+        free(doc);
+        return NULL;
+    }
+
+    struct doc_builder builder;
+    builder.doc = doc;
+    builder.depth = 0;
+
+    struct json_reader reader;
+    json_reader_init(&reader, buffer, length);
+
+    /*
+     * The walk stops without an error in the text only when the index cannot
+     * grow.
+     */
+    if (!json_reader_walk(&reader, &doc_events, &builder)) {
+        if (reader.status != JSON_SUCCESS) *status = reader.status;
+        json_doc_close(doc);
+        return NULL;
+    }
+    if (json_reader_next(&reader) != JSON_TOKEN_END) {
+        *status = (reader.status != JSON_SUCCESS) ? reader.status
+                                                  : JSON_UNEXPECTED_CHARACTER;
+        json_doc_close(doc);
+        return NULL;
+    }
+
+    doc->root = doc_node(doc, 0);
+    if (!doc->root) {
+        json_doc_close(doc);
+        return NULL;
+    }
+
+    *status = JSON_SUCCESS;
+    return doc;
+}
+
+struct json *
+json_doc_root(struct json_doc *doc)
+{
+    return doc ? doc->root : NULL;
+}
+
+void
+json_doc_close(struct json_doc *doc)
+{
+    if (!doc) return;
+    json_free(doc->root);
+    json_keys_free(doc->keys);
+    free(doc->entries);
+    free(doc);
+}
+
+/**
+ * Expansion of pending values.
+ *
+ * A container is expanded into a complete object or array whose children
+ * are new pending nodes.  If any allocation fails, the partial result is
+ * released and the value stays pending, so the expansion can be retried.
+ */
+
+static bool
+expand_object(struct json_doc *doc, size_t entry, struct json *object)
+{
+    size_t last = entry + doc->entries[entry].span;
+
+    for (size_t i = entry + 1; i < last; ) {
+        const struct json_doc_entry *key = &doc->entries[i];
+
+        size_t length;
+        uint8_t *decoded;
+        const uint8_t *text = json_read_text(doc->buffer + key->offset, key->span,
+                                             &length, &decoded);
+        if (!text) return false;
+
+        struct json *value = doc_node(doc, i + 1);
+        struct json_member *member =
+            value ? json_member_make(text, length, value, doc->keys) : NULL;
+        free(decoded);
+
+        if (!member) {
+            json_free(value);
+            return false;
+        }
+        if (!json_object_append(object, member)) {
+            json_member_free(member);
+            return false;
+        }
+
+        i = next_entry(doc, i + 1);
+    }
+    return true;
+}
+
+static bool
+is_number(const struct json_doc *doc, size_t entry)
+{
+    uint8_t c = doc->buffer[doc->entries[entry].offset];
+    return c == '-' || (c >= '0' && c <= '9');
+}
+
+/**
+ * Arrays of numbers only are created packed, converting every element at
+ * once, since they would otherwise be packed on first use anyway.
+ */
+
+static bool
+expand_numbers(struct json_doc *doc, size_t entry, size_t count,
+               struct json *array)
+{
+    struct json_numbers *numbers = json_numbers_new(count);
+    if (!numbers) return false;
+
+    size_t last = entry + doc->entries[entry].span;
+    numbers->count = 0;
+
+    for (size_t i = entry + 1; i < last; i++) {
+        const struct json_doc_entry *number = &doc->entries[i];
+        numbers->values[numbers->count++] =
+            json_read_number(doc->buffer + number->offset, number->span);
+    }
+
+    array->data.numbers = numbers;
+    array->tag |= JSON_TAG_PACKED;
+    return true;
+}
+
+static bool
+expand_array(struct json_doc *doc, size_t entry, struct json *array)
+{
+    size_t last = entry + doc->entries[entry].span;
+
+    size_t count = 0;
+    bool numeric = true;
+    for (size_t i = entry + 1; i < last; i = next_entry(doc, i)) {
+        numeric = numeric && is_number(doc, i);
+        count++;
+    }
+
+    if (!count) return true;
+    if (numeric) return expand_numbers(doc, entry, count, array);
+    if (!json_array_reserve(array, count)) return false;
+
+    struct json_array *body = array->data.array;
+    for (size_t i = entry + 1; i < last; i = next_entry(doc, i)) {
+        struct json *item = doc_node(doc, i);
+        if (!item) return false;
+        body->items[body->count++] = item;
+    }
+    return true;
+}
+
+bool
+json_doc_expand(struct json *json)
+{
+    if (!(json->tag & JSON_TAG_PENDING)) return true;
+
+    struct json_doc *doc = json->data.doc;
+    size_t entry = json->aux;
+    const uint8_t *text = doc->buffer + doc->entries[entry].offset;
+
+    struct json expanded = { .tag = json_kind(json) };
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT:
+            if (!expand_object(doc, entry, &expanded)) {
+                json_object_release(expanded.data.object);
+                return false;
+            }
+            break;
+        case JSON_TYPE_ARRAY:
+            if (!expand_array(doc, entry, &expanded)) {
+                json_array_release(expanded.data.array);
+                return false;
+            }
+            break;
+        case JSON_TYPE_STRING: {
+            uint8_t *string = json_read_string(text, doc->entries[entry].span);
+            if (!string) return false;
+            json_take_string(&expanded, string);
+            break;
+        }
+        case JSON_TYPE_NUMBER:
+            expanded.data.number = json_read_number(text, doc->entries[entry].span);
+            break;
+        case JSON_TYPE_BOOLEAN:
+        case JSON_TYPE_NULL:
+            break;
+    }
+
+    *json = expanded;
+    return true;
+}
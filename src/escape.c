@@ -54,7 +54,7 @@ read_utf16(const uint8_t **src, const uint8_t *end)
     int code = read_u16(src, end);
     if (code < 0) return -1;
     
-    if (code < 0xD800) {
+    if (code < 0xD800 || code > 0xDFFF) {
         return code;
     }
     else if (code <= 0xDBFF) {
@@ -118,6 +118,14 @@ json_unescape_string(const uint8_t *start, size_t length, enum json_status *erro
                     }
                 }
             }
+        } else if (*src >= 0x80) {
+            uint32_t point;
+            if (!decode_next_UTF8(&src, end, &point)) {
+                if (error) *error = JSON_INVALID_UNICODE;
+                ustring_free(result);
+                return NULL;
+            }
+            code = point;
         } else {
             code = *src++;
         }
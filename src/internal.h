@@ -23,59 +23,188 @@
  * A JSON object stores an unordered collection of unique key-value pairs,
  * where each key is a UTF-8 encoded string and each value is a JSON data type.
  * Members are stored as a linked list for dynamic and flexible storage.
+ *
+ * The list and its bookkeeping live in one allocation that a value refers to
+ * through a pointer, which is NULL until the first member is added.  Once an object
+ * has JSON_OBJECT_INDEX_MIN members, it also keeps an open-addressing table
+ * of its members by key hash, so lookups no longer walk the list.
+ *
+ * Printing with sorted keys keeps the sorted order of the members in
+ * `sorted`, built on first use and dropped whenever a member is added or
+ * removed, so an unchanged object is sorted only once.
  */
 
+#define JSON_OBJECT_INDEX_MIN 8
+
 struct json_object {
     struct json_member *members;
+    struct json_member *last;
+    size_t count;
+
+    struct json_member **index;
+    size_t slots;
+
+    struct json_member **sorted;
 };
 
-void json_object_init(struct json_object *object);
 void json_object_release(struct json_object *object);
+void json_object_unsort(struct json_object *object);
+struct json_member **json_object_sorted(struct json_object *object);
+bool json_object_append(struct json *json, struct json_member *member);
+bool json_object_reserve(struct json *json, size_t count);
+struct json_member *json_object_find(const struct json_object *object,
+                                     const uint8_t *key, uint64_t hash);
+
+/**
+ * Each member records the hash and length of its key, so lookups compare
+ * hashes before comparing bytes.  Interned keys belong to a key pool and are
+ * compared by address first.
+ */
 
 struct json_member {
     uint8_t *key;
     struct json *value;
     struct json_member *next;
+    uint64_t hash;
+    uint32_t length;
+    bool interned;
 };
 
-struct json_member *json_member_new(const uint8_t *key, struct json *value);
+struct json_member *json_member_make(const uint8_t *key, size_t length,
+                                     struct json *value,
+                                     struct json_keys *keys);
 void json_member_free(struct json_member *member);
 
+struct json *json_get_object_item(struct json *json, const uint8_t *key);
+
 /**
  * A JSON array is an ordered list of JSON values, dynamically allocated
  * with adjustable capacity to accommodate elements as needed.
+ *
+ * The counts and the element pointers share a single allocation, and a value
+ * refers to it through one pointer, which is NULL while the array is empty.
  */
 
 struct json_array {
-    struct json **items;
     size_t capacity;
     size_t count;
+    struct json *items[];
 };
 
-void json_array_init(struct json_array *array);
 void json_array_release(struct json_array *array);
 
+/**
+ * An array whose elements are all numbers may instead be stored packed, as a
+ * single block of doubles with no node per element.  JSON_TAG_PACKED marks
+ * such arrays, whose `data.numbers` is never NULL.  Reading an element makes
+ * a node for it on first access, kept in `nodes`, which stays NULL until
+ * then; changing the array unpacks it into ordinary nodes first.
+ */
+
+struct json_numbers {
+    size_t count;
+    struct json **nodes;
+    double values[];
+};
+
+struct json_numbers *json_numbers_new(size_t capacity);
+void json_numbers_free(struct json_numbers *numbers);
+bool json_array_unpack(struct json *json);
+
+struct json *json_get_array_item(struct json *json, size_t index);
+
 /**
  * Generic JSON value.
  *
- * This structure stores a JSON value of any type, using a tagged union.
- * This structure serves as the core representation of JSON data, allowing
- * dynamic storage and manipulation of objects, arrays, strings, numbers,
- * booleans, and null values.
+ * This structure stores a JSON value of any type in 16 bytes.  The first
+ * byte is a tag holding the type in its low bits and flags above them.
+ * Strings of up to JSON_INLINE_STRING bytes are stored in the node itself,
+ * in the bytes following the tag; all other values use the data union in the
+ * second word.  Arrays of numbers may be stored packed, as described above.
+ * The `aux` field is free for bookkeeping by values that do not store an
+ * inline string.
+ *
+ * A value opened through json_doc_open starts out pending: its type is known,
+ * but `data.doc` and `aux` still refer to an entry in the document index.
+ * The first access through the library expands the value in place, creating
+ * pending nodes for its immediate children only.  Code that reads a value's
+ * contents directly must call json_resolve first.
+ *
+ * A frozen value is immutable and may be shared between threads.  Unless it
+ * is an inline string, its `aux` field holds an atomic reference count, and
+ * freeing it only drops one reference.
  */
 
+#define JSON_TAG_TYPE       0x07
+#define JSON_TAG_PENDING    0x08
+#define JSON_TAG_INLINE     0x10
+#define JSON_TAG_PACKED     0x20
+#define JSON_TAG_FROZEN     0x40
+
+#define JSON_INLINE_STRING  14
+
 struct json {
-    enum json_type type;
-    
     union {
-        struct json_object object;
-        struct json_array array;
-        uint8_t *string;
-        double number;
-        bool boolean;
-    } data;
+        struct {
+            uint8_t tag;
+            uint8_t spare[3];
+            uint32_t aux;
+
+            union {
+                struct json_object *object;
+                struct json_array *array;
+                struct json_numbers *numbers;
+                uint8_t *string;
+                double number;
+                bool boolean;
+                struct json_doc *doc;
+            } data;
+        };
+        uint8_t bytes[16];
+    };
 };
 
+_Static_assert(sizeof(struct json) == 16, "struct json must be 16 bytes");
+
+struct json *json_new_value(enum json_type type);
+
+static inline enum json_type
+json_kind(const struct json *json)
+{
+    return (enum json_type)(json->tag & JSON_TAG_TYPE);
+}
+
+static inline const uint8_t *
+json_string(const struct json *json)
+{
+    return (json->tag & JSON_TAG_INLINE) ? json->bytes + 1 : json->data.string;
+}
+
+bool json_doc_expand(struct json *json);
+
+static inline bool
+json_resolve(const struct json *json)
+{
+    return !(json->tag & JSON_TAG_PENDING) || json_doc_expand((struct json *)json);
+}
+
+/**
+ * Drops one reference to a frozen value.  Returns true if the value is not
+ * shared, or if this was its last reference, so that it must be freed.
+ */
+
+static inline bool
+json_unshare(struct json *json)
+{
+    if (!(json->tag & JSON_TAG_FROZEN) || (json->tag & JSON_TAG_INLINE))
+        return true;
+    return __atomic_sub_fetch(&json->aux, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+bool json_set_string(struct json *json, const uint8_t *string, size_t length);
+void json_take_string(struct json *json, uint8_t *string);
+bool json_set_base64url(struct json *json, const uint8_t *bytes, size_t length);
+
 /**
  * Parses a JSON number and returns its value as double.
  *
@@ -94,4 +223,253 @@ double scan_json_number(const char *text);
  */
 uint8_t *scan_json_string(const char *text);
 
+/**
+ * Converts an array of numbers matched by the lexer as a single token into a
+ * packed array.
+ */
+struct json *scan_json_numbers(const char *text, size_t length);
+
+/**
+ * Converts a validated number lexeme without strtod when the result is
+ * guaranteed to be exact; returns false if the caller must use strtod.
+ */
+bool json_number_exact(const uint8_t *text, size_t length, double *value);
+
+/**
+ * Key pools.
+ *
+ * Members take their keys from the pool passed to json_member_make or
+ * json_object_add_in, never from one set elsewhere.  The parser passes
+ * json_parse_keys, which json_parse_interned sets for the duration of its
+ * parse.  Interned keys are reference counted by their members, which take
+ * further references through json_keys_retain and drop them through
+ * json_keys_release.
+ */
+
+extern struct json_keys *json_parse_keys;
+
+bool json_object_add_in(struct json *json, const uint8_t *key,
+                        struct json *value, struct json_keys *keys);
+
+uint64_t json_hash_bytes(const uint8_t *data, size_t length);
+uint8_t *json_keys_intern(struct json_keys *keys, const uint8_t *text,
+                          size_t length, uint64_t hash);
+void     json_keys_retain(uint8_t *text);
+void     json_keys_release(uint8_t *text);
+
+/**
+ * Hashes consistent with json_hash, remembering the hash of each container so
+ * that hashing all the subtrees of a tree costs a single pass.  The values
+ * must not change while the cache is in use.  A zeroed cache is empty.
+ */
+
+struct json_hash_cache {
+    const struct json **nodes;
+    uint64_t *hashes;
+    size_t slots;
+    size_t size;
+};
+
+uint64_t json_hash_cached(const struct json *json, struct json_hash_cache *cache);
+void     json_hash_cache_free(struct json_hash_cache *cache);
+
+/**
+ * Compiled JSON Pointer.
+ *
+ * Each reference token is stored decoded, with its length and hash, and with
+ * the array index it denotes, or JSON_POINTER_NO_INDEX if it is not a valid
+ * index.  Projection paths are compiled the same way.
+ */
+
+#define JSON_POINTER_NO_INDEX SIZE_MAX
+
+struct json_pointer_token {
+    uint8_t *key;
+    size_t length;
+    uint64_t hash;
+    size_t index;
+};
+
+struct json_pointer {
+    size_t count;
+    struct json_pointer_token tokens[];
+};
+
+/**
+ * Evaluates the first `count` tokens of a pointer.  With one token fewer than
+ * the pointer has, this finds the container that its last token indexes.
+ * Unlike json_pointer_get, it unpacks a packed array it indexes, so the
+ * value it returns can be changed in place.
+ */
+struct json *json_pointer_walk(const struct json *json,
+                               const struct json_pointer *pointer, size_t count);
+
+/**
+ * Field projection used by the grammar actions.
+ *
+ * While a projection is installed in json_projection, the grammar reports
+ * each container and each key or array position before the value is read.
+ * json_skip_value tells the lexer to return the next value as SKIPPED.
+ */
+
+struct json_projection;
+
+extern struct json_projection *json_projection;
+extern int json_skip_value;
+
+struct json_projection *json_projection_new(const uint8_t *const *paths,
+                                            size_t count);
+void json_projection_free(struct json_projection *projection);
+
+void json_project_root(void);
+void json_project_key(const uint8_t *key);
+void json_project_element(void);
+bool json_project_enter(void);
+void json_project_leave(void);
+
+/**
+ * Tokenizer for JSON text held in memory.
+ *
+ * Recognizes the same tokens as the generated lexer, but reads from a byte
+ * buffer and validates each lexeme in place without copying or decoding it.
+ * After each call, `token` and `length` describe the lexeme just read.  On
+ * error, `status` describes the problem and `cursor` points at it.
+ */
+
+enum json_token {
+    JSON_TOKEN_END,
+    JSON_TOKEN_ERROR,
+    JSON_TOKEN_BEGIN_OBJECT,
+    JSON_TOKEN_END_OBJECT,
+    JSON_TOKEN_BEGIN_ARRAY,
+    JSON_TOKEN_END_ARRAY,
+    JSON_TOKEN_COLON,
+    JSON_TOKEN_COMMA,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL
+};
+
+struct json_reader {
+    const uint8_t *start;
+    const uint8_t *end;
+    const uint8_t *cursor;
+    const uint8_t *token;
+    size_t length;
+    enum json_status status;
+};
+
+void json_reader_init(struct json_reader *reader, const uint8_t *text,
+                      size_t length);
+enum json_token json_reader_next(struct json_reader *reader);
+
+/**
+ * Walks one complete value and reports its structure.
+ *
+ * Callbacks receive the raw lexeme of each key and scalar, including the
+ * quotes of strings, and the position of each bracket.  Any callback may be
+ * NULL, and any callback may return false to stop the walk.  Nesting deeper
+ * than JSON_MAX_DEPTH is rejected so that the walk never allocates.
+ */
+
+#define JSON_MAX_DEPTH 1024
+
+struct json_events {
+    bool (*begin)(void *context, const uint8_t *at);
+    bool (*end)(void *context, const uint8_t *at);
+    bool (*key)(void *context, const uint8_t *text, size_t length);
+    bool (*scalar)(void *context, const uint8_t *text, size_t length);
+};
+
+bool json_reader_walk(struct json_reader *reader,
+                      const struct json_events *events, void *context);
+
+/**
+ * Skips the remainder of a value inside `depth` open containers, leaving the
+ * reader just past the bracket that closes the outermost one.
+ */
+bool json_reader_skip(struct json_reader *reader, size_t depth);
+
+/**
+ * Iterates over a stream of records held in memory.  Each successful call to
+ * json_records_next leaves the reader before the next record, to be read
+ * with json_reader_walk.  It returns false at the end of the stream, or on
+ * error, which is recorded in the reader's status.
+ */
+
+struct json_record_stream {
+    struct json_reader reader;
+    enum json_records layout;
+    bool started;
+};
+
+void json_records_init(struct json_record_stream *stream, const uint8_t *buffer,
+                       size_t length, enum json_records layout);
+bool json_records_next(struct json_record_stream *stream);
+
+/**
+ * Follows up to 64 fields, given as JSON Pointers, through the walk of a
+ * record.  Each open container keeps the fields that may lie within it.  As
+ * each value starts, json_fields_enter sets `ended` to the fields that end at
+ * it and returns those that continue within it, to be kept by
+ * json_fields_open if it is a container.  json_fields_key records the key of
+ * each member, unescaped into `decoded` if needed, which the owner frees.
+ */
+
+struct json_field_frame {
+    uint64_t fields;
+    size_t index;
+    bool array;
+};
+
+struct json_fields {
+    struct json_pointer *const *pointers;
+    uint64_t all;
+    size_t depth;
+    struct json_field_frame frames[JSON_MAX_DEPTH + 1];
+    const uint8_t *key;
+    size_t key_length;
+    uint8_t *decoded;
+};
+
+uint64_t json_fields_enter(struct json_fields *fields, uint64_t *ended);
+void     json_fields_open(struct json_fields *fields, uint64_t within, bool array);
+bool     json_fields_key(struct json_fields *fields, const uint8_t *text,
+                         size_t length);
+
+/**
+ * Comparisons in JSONPath filters and record predicates.  json_parse_compare
+ * reads an operator at `*cursor` and moves past it, returning
+ * JSON_COMPARE_NONE if there is none.  json_compare_order tells whether a
+ * comparison holds given the order of the two operands, as from strcmp.
+ */
+
+enum json_compare {
+    JSON_COMPARE_NONE,
+    JSON_COMPARE_EQUAL,
+    JSON_COMPARE_NOT_EQUAL,
+    JSON_COMPARE_LESS,
+    JSON_COMPARE_LESS_EQUAL,
+    JSON_COMPARE_GREATER,
+    JSON_COMPARE_GREATER_EQUAL
+};
+
+const uint8_t    *json_skip_space(const uint8_t *text);
+enum json_compare json_parse_compare(const uint8_t **cursor);
+bool              json_compare_order(enum json_compare compare, int order);
+
+/**
+ * Converts lexemes accepted by the reader.  Strings are passed with their
+ * quotes and are returned newly allocated and unescaped.  json_read_text
+ * returns the text of a string in place when it has no escapes, and
+ * otherwise unescapes it into `*decoded`, which the caller frees; either way
+ * `*size` is set to its length.  It returns NULL if memory runs out.
+ */
+double         json_read_number(const uint8_t *text, size_t length);
+uint8_t       *json_read_string(const uint8_t *text, size_t length);
+const uint8_t *json_read_text(const uint8_t *text, size_t length, size_t *size,
+                              uint8_t **decoded);
+
 #endif
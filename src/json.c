@@ -17,6 +17,7 @@
 #include <errno.h>
 
 int yyparse(void);
+void json_lex_reset(void);
 
 extern FILE *yyin;
 extern int yy_flex_debug;
@@ -35,6 +36,8 @@ json_parse(FILE *in, enum json_status *status)
 {
     yyin = in;
     yy_flex_debug = 0;
+    json_root = NULL;
+    json_lex_reset();
     
     int result = yyparse();
     if (result == 0) {
@@ -55,36 +58,34 @@ json_parse(FILE *in, enum json_status *status)
  */
 
 struct json *
-json_new_object(void)
+json_new_value(enum json_type type)
 {
     struct json *result = calloc(1, sizeof(*result));
     if (!result) return NULL;
 
-    result->type = JSON_TYPE_OBJECT;
-    json_object_init(&result->data.object);
+    result->tag = type;
     return result;
 }
 
 struct json *
-json_new_array(void)
+json_new_object(void)
 {
-    struct json *result = calloc(1, sizeof(*result));
-    if (!result) return NULL;
+    return json_new_value(JSON_TYPE_OBJECT);
+}
 
-    result->type = JSON_TYPE_ARRAY;
-    json_array_init(&result->data.array);
-    return result;
+struct json *
+json_new_array(void)
+{
+    return json_new_value(JSON_TYPE_ARRAY);
 }
 
 struct json *
 json_new_string(const uint8_t *string)
 {
-    struct json *result = calloc(1, sizeof(*result));
+    struct json *result = json_new_value(JSON_TYPE_STRING);
     if (!result) return NULL;
 
-    result->type = JSON_TYPE_STRING;
-    result->data.string = (uint8_t*)strdup((const char*)string);
-    if (!result->data.string) {
+    if (!json_set_string(result, string, strlen((const char *)string))) {
         free(result);
         return NULL;
     }
@@ -94,10 +95,9 @@ json_new_string(const uint8_t *string)
 struct json *
 json_new_number(double number)
 {
-    struct json *result = calloc(1, sizeof(*result));
+    struct json *result = json_new_value(JSON_TYPE_NUMBER);
     if (!result) return NULL;
 
-    result->type = JSON_TYPE_NUMBER;
     result->data.number = number;
     return result;
 }
@@ -105,10 +105,9 @@ json_new_number(double number)
 struct json *
 json_new_boolean(bool value)
 {
-    struct json *result = calloc(1, sizeof(*result));
+    struct json *result = json_new_value(JSON_TYPE_BOOLEAN);
     if (!result) return NULL;
 
-    result->type = JSON_TYPE_BOOLEAN;
     result->data.boolean = value;
     return result;
 }
@@ -116,11 +115,7 @@ json_new_boolean(bool value)
 struct json *
 json_new_null(void)
 {
-    struct json *result = calloc(1, sizeof(*result));
-    if (!result) return NULL;
-
-    result->type = JSON_TYPE_NULL;
-    return result;
+    return json_new_value(JSON_TYPE_NULL);
 }
 
 void
@@ -128,10 +123,24 @@ json_free(struct json *value)
 {
     if (!value) return;
 
-    switch (value->type) {
-        case JSON_TYPE_OBJECT:   json_object_release(&value->data.object); break;
-        case JSON_TYPE_ARRAY:    json_array_release(&value->data.array); break;
-        case JSON_TYPE_STRING:   free(value->data.string); break;
+    if (!json_unshare(value)) return;
+
+    if (value->tag & JSON_TAG_PENDING) {
+        free(value);
+        return;
+    }
+
+    switch (json_kind(value)) {
+        case JSON_TYPE_OBJECT:   json_object_release(value->data.object); break;
+        case JSON_TYPE_ARRAY:
+            if (value->tag & JSON_TAG_PACKED)
+                json_numbers_free(value->data.numbers);
+            else
+                json_array_release(value->data.array);
+            break;
+        case JSON_TYPE_STRING:
+            if (!(value->tag & JSON_TAG_INLINE)) free(value->data.string);
+            break;
         case JSON_TYPE_NUMBER:   break;
         case JSON_TYPE_BOOLEAN:  break;
         case JSON_TYPE_NULL:     break;
@@ -140,19 +149,84 @@ json_free(struct json *value)
 }
 
 /**
- * Implementation of JSON objects.
+ * Storage of string values.
  *
- * Each object maintains its key–value pairs in a linked list, allowing dynamic
- * insertion, removal, and iteration as values are parsed or constructed.
+ * Strings short enough to fit in the node are copied into it; longer strings
+ * are copied to, or adopted as, a separate allocation.  The string must not
+ * yet have contents.
  */
 
+bool
+json_set_string(struct json *json, const uint8_t *string, size_t length)
+{
+    if (length <= JSON_INLINE_STRING) {
+        json->tag |= JSON_TAG_INLINE;
+        memcpy(json->bytes + 1, string, length);
+        json->bytes[1 + length] = '\0';
+        return true;
+    }
+
+    uint8_t *copy = malloc(length + 1);
+    if (!copy) return false;
+
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    json->data.string = copy;
+    return true;
+}
+
 void
-json_object_init(struct json_object *object)
+json_take_string(struct json *json, uint8_t *string)
 {
-    if (!object) return;
-    object->members = NULL;
+    size_t length = strlen((const char *)string);
+
+    if (length <= JSON_INLINE_STRING) {
+        json_set_string(json, string, length);
+        free(string);
+    } else {
+        json->data.string = string;
+    }
 }
 
+/**
+ * Sets a string to binary data encoded as base64url without padding, the
+ * text form binary formats use for bytes JSON cannot hold.
+ */
+
+bool
+json_set_base64url(struct json *json, const uint8_t *bytes, size_t length)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    uint8_t *text = malloc(length / 3 * 4 + 4);
+    if (!text) return false;
+
+    size_t n = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t)bytes[i] << 16;
+        if (i + 1 < length) group |= (uint32_t)bytes[i + 1] << 8;
+        if (i + 2 < length) group |= bytes[i + 2];
+
+        size_t produced = (length - i >= 3) ? 4 : length - i + 1;
+        for (size_t k = 0; k < produced; k++)
+            text[n++] = (uint8_t)digits[(group >> (18 - 6 * k)) & 0x3F];
+    }
+    text[n] = '\0';
+
+    json_take_string(json, text);
+    return true;
+}
+
+/**
+ * Implementation of JSON objects.
+ *
+ * Each object maintains its key–value pairs in a linked list, allowing dynamic
+ * insertion, removal, and iteration as values are parsed or constructed.
+ * Larger objects index their members by key hash in an open-addressing table
+ * with linear probing, kept at most half full.
+ */
+
 void
 json_object_release(struct json_object *object)
 {
@@ -165,19 +239,49 @@ json_object_release(struct json_object *object)
         link = next;
     }
 
-    object->members = NULL;
+    free(object->index);
+    free(object->sorted);
+    free(object);
+}
+
+/**
+ * Drops the sorted view of an object whose members have changed.  Only a
+ * mutable object can change, and it is never shared, so no other thread can
+ * be reading the view.
+ */
+
+void
+json_object_unsort(struct json_object *object)
+{
+    free(object->sorted);
+    object->sorted = NULL;
 }
 
 struct json_member *
-json_member_new(const uint8_t *key, struct json *value)
+json_member_make(const uint8_t *key, size_t length, struct json *value,
+                 struct json_keys *keys)
 {
+    if (length > UINT32_MAX) return NULL;
+
     struct json_member *result = malloc(sizeof(*result));
     if (!result) return NULL;
 
-    result->key = (uint8_t*)strdup((char *)key);
+    result->hash = json_hash_bytes(key, length);
+    result->length = (uint32_t)length;
+    result->interned = (keys != NULL);
     result->value = value;
     result->next = NULL;
-    
+
+    if (keys) {
+        result->key = json_keys_intern(keys, key, length, result->hash);
+    } else {
+        result->key = malloc(length + 1);
+        if (result->key) {
+            memcpy(result->key, key, length);
+            result->key[length] = '\0';
+        }
+    }
+
     if (!result->key) {
         free(result);
         return NULL;
@@ -190,51 +294,287 @@ json_member_free(struct json_member *member)
 {
     if (!member) return;
     json_free(member->value);
-    free(member->key);
+
+    if (member->interned)
+        json_keys_release(member->key);
+    else
+        free(member->key);
     free(member);
 }
 
+static bool
+member_matches(const struct json_member *member, const uint8_t *key,
+               uint64_t hash)
+{
+    return member->key == key
+        || (member->hash == hash
+            && strcmp((const char *)member->key, (const char *)key) == 0);
+}
+
+static void
+index_insert(struct json_member **index, size_t slots,
+             struct json_member *member)
+{
+    size_t slot = member->hash & (slots - 1);
+    while (index[slot])
+        slot = (slot + 1) & (slots - 1);
+    index[slot] = member;
+}
+
+/**
+ * Rebuilds the member index with room for `capacity` members.  Without
+ * memory for a new table, the object is left unindexed, which only makes
+ * lookups slower.
+ */
+
+static void
+index_build(struct json_object *object, size_t capacity)
+{
+    size_t slots = 2 * JSON_OBJECT_INDEX_MIN;
+    while (slots < capacity * 2)
+        slots *= 2;
+
+    struct json_member **index = calloc(slots, sizeof(*index));
+
+    free(object->index);
+    object->index = index;
+    object->slots = index ? slots : 0;
+    if (!index) return;
+
+    for (struct json_member *member = object->members; member; member = member->next)
+        index_insert(index, slots, member);
+}
+
+/**
+ * Prepares an object for `count` members in all, so that a decoder that
+ * knows the size of an object before reading its members builds the index
+ * once instead of growing it.
+ */
+
+bool
+json_object_reserve(struct json *json, size_t count)
+{
+    struct json_object *object = json->data.object;
+    if (!object) {
+        object = calloc(1, sizeof(*object));
+        if (!object) return false;
+        json->data.object = object;
+    }
+
+    if (count >= JSON_OBJECT_INDEX_MIN && count <= SIZE_MAX / 4
+        && count * 2 > object->slots)
+        index_build(object, count);
+    return true;
+}
+
+/**
+ * Links a member at the end of an object without checking for duplicates.
+ * The member must not belong to another object.
+ */
+
 bool
-json_object_add(struct json *json, const uint8_t *key, struct json *value)
+json_object_append(struct json *json, struct json_member *member)
 {
-    if (json->type != JSON_TYPE_OBJECT)
-        return false;
+    struct json_object *object = json->data.object;
+    if (!object) {
+        object = calloc(1, sizeof(*object));
+        if (!object) return false;
+        json->data.object = object;
+    }
 
-    struct json_object *object = &json->data.object;
-    struct json_member **link = &object->members;
+    member->next = NULL;
+    if (object->last)
+        object->last->next = member;
+    else
+        object->members = member;
+    object->last = member;
+    object->count++;
+    json_object_unsort(object);
 
-    while (*link) {
-        struct json_member *member = *link;
+    if (object->index && object->count * 2 <= object->slots)
+        index_insert(object->index, object->slots, member);
+    else if (object->count >= JSON_OBJECT_INDEX_MIN)
+        index_build(object, object->count);
+    return true;
+}
+
+struct json_member *
+json_object_find(const struct json_object *object, const uint8_t *key,
+                 uint64_t hash)
+{
+    if (!object) return NULL;
 
-        if (strcmp((char *)member->key, (char *)key) == 0) {
-            json_free(member->value);
-            member->value = value;
-            return true;
+    if (object->index) {
+        size_t mask = object->slots - 1;
+        for (size_t slot = hash & mask; object->index[slot]; slot = (slot + 1) & mask) {
+            if (member_matches(object->index[slot], key, hash))
+                return object->index[slot];
         }
-        link = &member->next;
+        return NULL;
+    }
+
+    for (struct json_member *link = object->members; link; link = link->next) {
+        if (member_matches(link, key, hash))
+            return link;
+    }
+    return NULL;
+}
+
+/**
+ * Frozen values are shared read-only, so every change to them is refused.
+ */
+
+static bool
+object_mutable(struct json *json)
+{
+    return json_kind(json) == JSON_TYPE_OBJECT
+        && !(json->tag & JSON_TAG_FROZEN) && json_resolve(json);
+}
+
+bool
+json_object_add(struct json *json, const uint8_t *key, struct json *value)
+{
+    return json_object_add_in(json, key, value, NULL);
+}
+
+bool
+json_object_add_in(struct json *json, const uint8_t *key, struct json *value,
+                   struct json_keys *keys)
+{
+    if (!object_mutable(json))
+        return false;
+
+    size_t length = strlen((const char *)key);
+    uint64_t hash = json_hash_bytes(key, length);
+    struct json_member *member = json_object_find(json->data.object, key, hash);
+
+    if (member) {
+        json_free(member->value);
+        member->value = value;
+        return true;
     }
 
-    struct json_member *added = json_member_new(key, value);
+    struct json_member *added = json_member_make(key, length, value, keys);
     if (!added) return false;
-    
-    *link = added;
+
+    if (!json_object_append(json, added)) {
+        added->value = NULL;
+        json_member_free(added);
+        return false;
+    }
     return true;
 }
 
 struct json *
 json_get_object_item(struct json *json, const uint8_t *key)
 {
-    if (json->type != JSON_TYPE_OBJECT)
+    if (json_kind(json) != JSON_TYPE_OBJECT || !json_resolve(json))
         return NULL;
 
-    struct json_member *link = json->data.object.members;
-    while (link) {
-        if (strcmp((char*)link->key, (char*)key) == 0) {
-            return link->value;
+    uint64_t hash = json_hash_bytes(key, strlen((const char *)key));
+    struct json_member *member = json_object_find(json->data.object, key, hash);
+    return member ? member->value : NULL;
+}
+
+/**
+ * Removal of object members.
+ *
+ * Index entries are deleted by shifting later entries of the same probe
+ * sequence back into the hole, so the table never accumulates tombstones.
+ * Bulk removal unlinks every matching member in one walk of the list and
+ * rebuilds the index once at the end.
+ */
+
+static void
+index_delete(struct json_object *object, const struct json_member *member)
+{
+    size_t mask = object->slots - 1;
+    size_t hole = member->hash & mask;
+    while (object->index[hole] != member)
+        hole = (hole + 1) & mask;
+
+    for (size_t next = (hole + 1) & mask; object->index[next]; next = (next + 1) & mask) {
+        size_t home = object->index[next]->hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            object->index[hole] = object->index[next];
+            hole = next;
         }
-        link = link->next;
     }
-    return NULL;
+    object->index[hole] = NULL;
+}
+
+bool
+json_object_remove(struct json *json, const uint8_t *key)
+{
+    if (!object_mutable(json))
+        return false;
+
+    struct json_object *object = json->data.object;
+    if (!object) return false;
+
+    uint64_t hash = json_hash_bytes(key, strlen((const char *)key));
+    struct json_member **link = &object->members;
+    struct json_member *previous = NULL;
+
+    for (; *link; previous = *link, link = &(*link)->next) {
+        struct json_member *member = *link;
+        if (!member_matches(member, key, hash)) continue;
+
+        if (object->index) index_delete(object, member);
+        if (object->last == member) object->last = previous;
+        *link = member->next;
+        object->count--;
+        json_object_unsort(object);
+
+        json_member_free(member);
+        return true;
+    }
+    return false;
+}
+
+size_t
+json_object_remove_if(struct json *json,
+                      bool (*predicate)(const uint8_t *key, struct json *value,
+                                        void *context),
+                      void *context)
+{
+    if (!object_mutable(json))
+        return 0;
+
+    struct json_object *object = json->data.object;
+    if (!object) return 0;
+
+    struct json_member **link = &object->members;
+    struct json_member *previous = NULL;
+    size_t removed = 0;
+
+    while (*link) {
+        struct json_member *member = *link;
+        if (!predicate(member->key, member->value, context)) {
+            previous = member;
+            link = &member->next;
+            continue;
+        }
+
+        *link = member->next;
+        json_member_free(member);
+        removed++;
+    }
+
+    object->last = previous;
+    object->count -= removed;
+    if (removed) json_object_unsort(object);
+
+    if (removed && object->index) {
+        if (object->count >= JSON_OBJECT_INDEX_MIN) {
+            index_build(object, object->count);
+        } else {
+            free(object->index);
+            object->index = NULL;
+            object->slots = 0;
+        }
+    }
+    return removed;
 }
 
 /**
@@ -245,71 +585,617 @@ json_get_object_item(struct json *json, const uint8_t *key)
  */
 
 void
-json_array_init(struct json_array *array)
+json_array_release(struct json_array *array)
 {
     if (!array) return;
-    array->items = NULL;
-    array->capacity = 0;
-    array->count = 0;
+    
+    for (size_t i = 0; i < array->count; i++) {
+        json_free(array->items[i]);
+    }
+    free(array);
+}
+
+/**
+ * Packed numeric arrays.
+ *
+ * An array of numbers only may be packed into one block of doubles, freeing
+ * the node of each element.  The parser and on-demand documents pack such
+ * arrays as they create them, and json_array_get_doubles then reads them in
+ * place.  Reading an element gives it a node of its own, made on first
+ * access, so a single read does not convert the whole array.  These nodes
+ * are frozen, each holding the reference the array owns, so the number in a
+ * node can never differ from the packed value.  Any change to the array
+ * unpacks it once into ordinary nodes, adopting the element nodes already
+ * made, so packing is invisible elsewhere.
+ */
+
+struct json_numbers *
+json_numbers_new(size_t capacity)
+{
+    const size_t max = (SIZE_MAX - sizeof(struct json_numbers)) / sizeof(double);
+    if (capacity > max) return NULL;
+
+    struct json_numbers *numbers =
+        malloc(sizeof(*numbers) + capacity * sizeof(*numbers->values));
+    if (!numbers) return NULL;
+
+    numbers->count = 0;
+    numbers->nodes = NULL;
+    return numbers;
 }
 
 void
-json_array_release(struct json_array *array)
+json_numbers_free(struct json_numbers *numbers)
 {
-    if (!array) return;
-    
+    if (numbers->nodes) {
+        for (size_t i = 0; i < numbers->count; i++)
+            json_free(numbers->nodes[i]);
+        free(numbers->nodes);
+    }
+    free(numbers);
+}
+
+/**
+ * Returns the node of an element of a packed array, making it if needed.
+ * Only unfrozen arrays are packed, so no other thread can be reading.
+ */
+
+static struct json *
+packed_item(struct json *json, size_t index)
+{
+    struct json_numbers *numbers = json->data.numbers;
+    if (index >= numbers->count) return NULL;
+
+    if (!numbers->nodes) {
+        numbers->nodes = calloc(numbers->count, sizeof(*numbers->nodes));
+        if (!numbers->nodes) return NULL;
+    }
+
+    struct json *node = numbers->nodes[index];
+    if (!node) {
+        node = json_new_number(numbers->values[index]);
+        if (!node) return NULL;
+
+        node->tag |= JSON_TAG_FROZEN;
+        node->aux = 1;
+        numbers->nodes[index] = node;
+    }
+    return node;
+}
+
+bool
+json_array_pack(struct json *json)
+{
+    if (json_kind(json) != JSON_TYPE_ARRAY || !json_resolve(json))
+        return false;
+    if (json->tag & JSON_TAG_FROZEN) return false;
+    if (json->tag & JSON_TAG_PACKED) return true;
+
+    struct json_array *array = json->data.array;
+    if (!array) return true;
+
     for (size_t i = 0; i < array->count; i++) {
+        struct json *item = array->items[i];
+        if (json_kind(item) != JSON_TYPE_NUMBER || !json_resolve(item))
+            return false;
+    }
+
+    struct json_numbers *numbers = json_numbers_new(array->count);
+    if (!numbers) return false;
+
+    numbers->count = array->count;
+    for (size_t i = 0; i < array->count; i++) {
+        numbers->values[i] = array->items[i]->data.number;
         json_free(array->items[i]);
     }
-    
-    free(array->items);
-    array->items = NULL;
-    array->capacity = 0;
-    array->count = 0;
+
+    free(array);
+    json->data.numbers = numbers;
+    json->tag |= JSON_TAG_PACKED;
+    return true;
 }
 
+bool
+json_array_unpack(struct json *json)
+{
+    if (!(json->tag & JSON_TAG_PACKED)) return true;
+
+    struct json_numbers *numbers = json->data.numbers;
+    struct json_array *array =
+        malloc(sizeof(*array) + numbers->count * sizeof(*array->items));
+    if (!array) return false;
+
+    array->capacity = numbers->count;
+    array->count = numbers->count;
+
+    /*
+     * Element nodes that only the array refers to are adopted as they are,
+     * once every other node has been made, so that failing part way leaves
+     * the packed array and its nodes untouched.
+     */
+    for (size_t i = 0; i < numbers->count; i++) {
+        struct json *node = numbers->nodes ? numbers->nodes[i] : NULL;
+        bool adopt = node && __atomic_load_n(&node->aux, __ATOMIC_ACQUIRE) == 1;
+
+        array->items[i] = adopt ? NULL : json_new_number(numbers->values[i]);
+        if (!adopt && !array->items[i]) {
+            array->count = i;
+            json_array_release(array);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < numbers->count; i++) {
+        if (array->items[i]) continue;
+
+        struct json *node = numbers->nodes[i];
+        node->tag &= ~JSON_TAG_FROZEN;
+        node->aux = 0;
+        array->items[i] = node;
+        numbers->nodes[i] = NULL;
+    }
+
+    json_numbers_free(numbers);
+    json->data.array = array;
+    json->tag &= ~JSON_TAG_PACKED;
+    return true;
+}
+
+bool
+json_array_get_doubles(const struct json *json, const double **values,
+                       size_t *count)
+{
+    if (!json || json_kind(json) != JSON_TYPE_ARRAY || !json_resolve(json))
+        return false;
+
+    if (json->tag & JSON_TAG_PACKED) {
+        *values = json->data.numbers->values;
+        *count = json->data.numbers->count;
+        return true;
+    }
+
+    if (!json->data.array) {
+        *values = NULL;
+        *count = 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Prepares an array for changes to its elements, expanding it if pending and
+ * unpacking it if packed.
+ */
+
 static bool
-array_reserve(struct json_array *list, size_t n)
+array_items(const struct json *json)
 {
-    const size_t max = SIZE_MAX / sizeof(*list->items);
-    if (n <= list->capacity) return true;
-    if (n > max) return false;
+    return json_kind(json) == JSON_TYPE_ARRAY && json_resolve(json)
+        && json_array_unpack((struct json *)json);
+}
 
-    size_t request = list->capacity ? list->capacity : 8;
-    while (request < n)
-        request = (request > max / 2) ? max : request * 2;
+static bool
+array_mutable(struct json *json)
+{
+    return !(json->tag & JSON_TAG_FROZEN) && array_items(json);
+}
 
-    void *resized = realloc(list->items, request * sizeof(*list->items));
+/**
+ * Resizes the body of an array to exactly `capacity` elements, allocating it
+ * if the array has none.  The capacity must not be less than the count.
+ */
+
+static bool
+array_resize(struct json *json, size_t capacity)
+{
+    struct json_array *array = json->data.array;
+
+    const size_t max = (SIZE_MAX - sizeof(*array)) / sizeof(*array->items);
+    if (capacity > max) return false;
+
+    void *resized = realloc(array, sizeof(*array) + capacity * sizeof(*array->items));
     if (!resized) return false;
 
-    list->items = resized;
-    list->capacity = request;
+    array = resized;
+    if (!json->data.array) array->count = 0;
+    array->capacity = capacity;
+    json->data.array = array;
     return true;
 }
 
+static bool
+array_reserve(struct json *json, size_t n)
+{
+    struct json_array *array = json->data.array;
+    size_t capacity = array ? array->capacity : 0;
+
+    const size_t max = (SIZE_MAX - sizeof(*array)) / sizeof(*array->items);
+    if (n <= capacity) return true;
+    if (n > max) return false;
+
+    size_t request = capacity ? capacity : 8;
+    while (request < n)
+        request = (request > max / 2) ? max : request * 2;
+
+    return array_resize(json, request);
+}
+
 bool
 json_array_add(struct json *value, struct json *item)
 {
-    if (value->type != JSON_TYPE_ARRAY)
+    if (!array_mutable(value))
         return false;
     
-    struct json_array *array = &value->data.array;
+    size_t count = value->data.array ? value->data.array->count : 0;
     
-    if (array->count == SIZE_MAX) return false;
-    if (!array_reserve(array, array->count + 1)) return false;
+    if (count == SIZE_MAX) return false;
+    if (!array_reserve(value, count + 1)) return false;
     
+    struct json_array *array = value->data.array;
     array->items[array->count++] = item;
     return true;
 }
 
+/**
+ * Capacity management.
+ *
+ * Reserving allocates exactly the requested capacity, so an array filled to
+ * a known size is allocated once.  Shrinking releases unused capacity, and
+ * the whole body once the array is empty.
+ */
+
+bool
+json_array_reserve(struct json *json, size_t capacity)
+{
+    if (!array_mutable(json))
+        return false;
+
+    struct json_array *array = json->data.array;
+    if (array && capacity <= array->capacity) return true;
+    return array_resize(json, capacity);
+}
+
+void
+json_array_shrink_to_fit(struct json *json)
+{
+    if (!array_mutable(json))
+        return;
+
+    struct json_array *array = json->data.array;
+    if (!array || array->count == array->capacity) return;
+
+    if (array->count == 0) {
+        free(array);
+        json->data.array = NULL;
+        return;
+    }
+    array_resize(json, array->count);
+}
+
+/**
+ * Replacement of a range of elements.
+ *
+ * A splice releases `count` elements starting at `index` and puts the `n`
+ * given values in their place, moving the elements after the range once,
+ * whatever the length of either range.  Capacity is reserved before the
+ * array is changed, so a failed splice leaves it as it was.
+ */
+
+bool
+json_array_splice(struct json *json, size_t index, size_t count,
+                  struct json *const *values, size_t n)
+{
+    if (!array_mutable(json))
+        return false;
+
+    size_t length = json->data.array ? json->data.array->count : 0;
+    if (index > length || count > length - index) return false;
+    if (n > count && n - count > SIZE_MAX - length) return false;
+
+    size_t result = length - count + n;
+    if (!array_reserve(json, result)) return false;
+
+    struct json_array *array = json->data.array;
+    if (!array) return true;
+
+    for (size_t i = index; i < index + count; i++)
+        json_free(array->items[i]);
+
+    memmove(&array->items[index + n], &array->items[index + count],
+            (length - index - count) * sizeof(*array->items));
+    if (n)
+        memcpy(&array->items[index], values, n * sizeof(*array->items));
+
+    array->count = result;
+    return true;
+}
+
+bool
+json_array_insert(struct json *json, size_t index, struct json *value)
+{
+    return json_array_splice(json, index, 0, &value, 1);
+}
+
+bool
+json_array_remove_range(struct json *json, size_t index, size_t count)
+{
+    return json_array_splice(json, index, count, NULL, 0);
+}
+
+bool
+json_array_remove(struct json *json, size_t index)
+{
+    return json_array_splice(json, index, 1, NULL, 0);
+}
+
 struct json *
 json_get_array_item(struct json *json, size_t index)
 {
-    if (json->type != JSON_TYPE_ARRAY)
+    if (!array_items(json))
         return NULL;
 
-    struct json_array *array = &json->data.array;
-    return (index < array->count) ? array->items[index] : NULL;
+    struct json_array *array = json->data.array;
+    return (array && index < array->count) ? array->items[index] : NULL;
+}
+
+/**
+ * Read access to JSON values.
+ *
+ * Pending values of an on-demand document are expanded on first access.  The
+ * expansion only fills in the value itself, so these functions accept const
+ * values even though the node is updated in place.
+ */
+
+enum json_type
+json_type(const struct json *json)
+{
+    return json_kind(json);
+}
+
+struct json *
+json_object_get(const struct json *json, const uint8_t *key)
+{
+    if (!json) return NULL;
+    return json_get_object_item((struct json *)json, key);
+}
+
+struct json *
+json_object_get_key(const struct json *json, const struct json_key *key)
+{
+    if (!json || !key || json_kind(json) != JSON_TYPE_OBJECT || !json_resolve(json))
+        return NULL;
+
+    struct json_member *member =
+        json_object_find(json->data.object, key->text, key->hash);
+    return member ? member->value : NULL;
+}
+
+struct json *
+json_array_get(const struct json *json, size_t index)
+{
+    if (!json || json_kind(json) != JSON_TYPE_ARRAY || !json_resolve(json))
+        return NULL;
+
+    if (json->tag & JSON_TAG_PACKED)
+        return packed_item((struct json *)json, index);
+
+    struct json_array *array = json->data.array;
+    return (array && index < array->count) ? array->items[index] : NULL;
+}
+
+size_t
+json_object_size(const struct json *json)
+{
+    if (!json || json_kind(json) != JSON_TYPE_OBJECT || !json_resolve(json))
+        return 0;
+    return json->data.object ? json->data.object->count : 0;
+}
+
+size_t
+json_array_length(const struct json *json)
+{
+    if (!json || json_kind(json) != JSON_TYPE_ARRAY || !json_resolve(json))
+        return 0;
+
+    if (json->tag & JSON_TAG_PACKED)
+        return json->data.numbers->count;
+    return json->data.array ? json->data.array->count : 0;
+}
+
+const uint8_t *
+json_get_string(const struct json *json)
+{
+    if (!json || json_kind(json) != JSON_TYPE_STRING || !json_resolve(json))
+        return NULL;
+    return json_string(json);
+}
+
+double
+json_get_number(const struct json *json)
+{
+    if (!json || json_kind(json) != JSON_TYPE_NUMBER || !json_resolve(json))
+        return 0;
+    return json->data.number;
+}
+
+bool
+json_get_boolean(const struct json *json)
+{
+    if (!json || json_kind(json) != JSON_TYPE_BOOLEAN)
+        return false;
+    return json->data.boolean;
+}
+
+/**
+ * Deep copies.
+ *
+ * The size of every part of the copy is known from the original, so each
+ * container body is allocated once at its final size, object indexes are
+ * built once, and strings and packed arrays are copied with memcpy.  Interned
+ * keys are shared with the original by taking a reference.  A copy is never
+ * pending or frozen, so it can be changed freely.
+ */
+
+static struct json *clone_value(const struct json *json);
+
+static bool
+clone_object(const struct json_object *object, struct json *result)
+{
+    struct json_object *copy = calloc(1, sizeof(*copy));
+    if (!copy) return false;
+    result->data.object = copy;
+
+    struct json_member **link = &copy->members;
+    for (const struct json_member *member = object->members; member;
+         member = member->next) {
+        struct json_member *added = malloc(sizeof(*added));
+        if (!added) return false;
+
+        *added = *member;
+        added->next = NULL;
+
+        if (member->interned) {
+            json_keys_retain(member->key);
+        } else {
+            added->key = malloc(member->length + 1);
+            if (added->key)
+                memcpy(added->key, member->key, member->length + 1);
+        }
+        added->value = added->key ? clone_value(member->value) : NULL;
+
+        if (!added->value) {
+            added->value = NULL;
+            json_member_free(added);
+            return false;
+        }
+
+        *link = added;
+        link = &added->next;
+        copy->last = added;
+        copy->count++;
+    }
+
+    if (copy->count >= JSON_OBJECT_INDEX_MIN)
+        index_build(copy, copy->count);
+    return true;
+}
+
+static bool
+clone_array(const struct json_array *array, struct json *result)
+{
+    struct json_array *copy =
+        malloc(sizeof(*copy) + array->count * sizeof(*copy->items));
+    if (!copy) return false;
+
+    copy->capacity = array->count;
+    copy->count = 0;
+    result->data.array = copy;
+
+    for (size_t i = 0; i < array->count; i++) {
+        struct json *item = clone_value(array->items[i]);
+        if (!item) return false;
+        copy->items[copy->count++] = item;
+    }
+    return true;
+}
+
+static struct json *
+clone_value(const struct json *json)
+{
+    if (!json_resolve(json)) return NULL;
+
+    struct json *result = malloc(sizeof(*result));
+    if (!result) return NULL;
+
+    *result = *json;
+    result->tag &= ~JSON_TAG_FROZEN;
+    if (!(result->tag & JSON_TAG_INLINE))
+        result->aux = 0;
+
+    bool copied = true;
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT:
+            if (json->data.object) {
+                result->data.object = NULL;
+                copied = clone_object(json->data.object, result);
+            }
+            break;
+        case JSON_TYPE_ARRAY:
+            if (json->tag & JSON_TAG_PACKED) {
+                size_t count = json->data.numbers->count;
+                result->data.numbers = json_numbers_new(count);
+                copied = (result->data.numbers != NULL);
+                if (copied) {
+                    memcpy(result->data.numbers->values, json->data.numbers->values,
+                           count * sizeof(double));
+                    result->data.numbers->count = count;
+                }
+                else result->tag &= ~JSON_TAG_PACKED;
+            } else if (json->data.array) {
+                result->data.array = NULL;
+                copied = clone_array(json->data.array, result);
+            }
+            break;
+        case JSON_TYPE_STRING:
+            if (!(json->tag & JSON_TAG_INLINE)) {
+                size_t size = strlen((const char *)json->data.string) + 1;
+                result->data.string = malloc(size);
+                copied = (result->data.string != NULL);
+                if (copied) memcpy(result->data.string, json->data.string, size);
+            }
+            break;
+        case JSON_TYPE_NUMBER:
+        case JSON_TYPE_BOOLEAN:
+        case JSON_TYPE_NULL:
+            break;
+    }
+
+    if (!copied) {
+        json_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+struct json *
+json_clone(const struct json *json)
+{
+    return json ? clone_value(json) : NULL;
+}
+
+/**
+ * Iteration over object members.
+ *
+ * The cursor points at the member to be returned next, so the member just
+ * returned may be removed.
+ */
+
+bool
+json_object_iter_begin(const struct json *json, struct json_object_iter *iter)
+{
+    iter->member = NULL;
+
+    if (!json || json_kind(json) != JSON_TYPE_OBJECT || !json_resolve(json))
+        return false;
+
+    iter->member = json->data.object ? json->data.object->members : NULL;
+    return true;
+}
+
+bool
+json_object_iter_next(struct json_object_iter *iter, const uint8_t **key,
+                      size_t *length, struct json **value)
+{
+    const struct json_member *member = iter->member;
+    if (!member) return false;
+
+    if (key) *key = member->key;
+    if (length) *length = member->length;
+    if (value) *value = member->value;
+
+    iter->member = member->next;
+    return true;
 }
 
 /**
@@ -320,8 +1206,8 @@ void yyerror(const char *s) {
     fprintf(stderr, "Lexical error: %s\n", s);
 }
 
-double
-scan_json_number(const char *text)
+static double
+read_number(const char *text)
 {
     errno = 0;
     char *end = NULL;
@@ -344,6 +1230,75 @@ scan_json_number(const char *text)
     }
 }
 
+double
+scan_json_number(const char *text)
+{
+    double value;
+    if (json_number_exact((const uint8_t *)text, strlen(text), &value))
+        return value;
+    return read_number(text);
+}
+
+/**
+ * Converts a whole array of numbers, matched by the lexer as one token such
+ * as `[1, 2.5, 3]`, directly into a packed array.  The elements are counted
+ * from the separators first, so the block of doubles is allocated once.
+ */
+
+static bool
+is_number_char(uint8_t c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.'
+        || c == 'e' || c == 'E';
+}
+
+static bool
+is_space(uint8_t c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+struct json *
+scan_json_numbers(const char *text, size_t length)
+{
+    const uint8_t *p = (const uint8_t *)text + 1;
+    const uint8_t *end = (const uint8_t *)text + length - 1;
+
+    size_t count = 1;
+    for (const uint8_t *q = p; q < end; q++)
+        count += (*q == ',');
+
+    struct json *result = json_new_value(JSON_TYPE_ARRAY);
+    struct json_numbers *numbers = json_numbers_new(count);
+
+    if (!result || !numbers) {
+        free(result);
+        free(numbers);
+        yyerror("Unable to allocate numbers.\n");
+        return NULL;
+    }
+
+    numbers->count = 0;
+    while (numbers->count < count) {
+        while (is_space(*p)) p++;
+
+        const uint8_t *start = p;
+        while (is_number_char(*p)) p++;
+
+        double value;
+        if (!json_number_exact(start, p - start, &value))
+            value = read_number((const char *)start);
+        numbers->values[numbers->count++] = value;
+
+        while (is_space(*p)) p++;
+        if (*p == ',') p++;
+    }
+
+    result->data.numbers = numbers;
+    result->tag |= JSON_TAG_PACKED;
+    return result;
+}
+
 uint8_t *
 scan_json_string(const char *text)
 {
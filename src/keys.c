@@ -0,0 +1,248 @@
+/**
+ * Interned object keys.
+ *
+ * A key pool stores one copy of each distinct key, together with its length
+ * and hash.  Members created while a pool is active refer to the pooled copy
+ * instead of duplicating the key, so documents with many records of the same
+ * shape hold each key once, and lookups can compare keys by address.
+ *
+ * Pooled keys are reference counted by the members that use them.  A key
+ * leaves the pool when its last member is freed, and freeing the pool only
+ * detaches the keys still in use, so documents may outlive the pool that
+ * interned their keys.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+struct json_key_entry {
+    struct json_keys *pool;
+    struct json_key_entry *chain;
+    uint64_t hash;
+    size_t length;
+    size_t refs;
+    uint8_t text[];
+};
+
+struct json_keys {
+    struct json_key_entry **buckets;
+    size_t capacity;
+    size_t count;
+};
+
+struct json_keys *json_parse_keys = NULL;
+
+/**
+ * 64-bit FNV-1a hash, used for keys and wherever the library hashes bytes.
+ */
+
+uint64_t
+json_hash_bytes(const uint8_t *data, size_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static struct json_key_entry *
+key_entry(const uint8_t *text)
+{
+    return (struct json_key_entry *)(text - offsetof(struct json_key_entry, text));
+}
+
+struct json_keys *
+json_keys_new(void)
+{
+    struct json_keys *result = calloc(1, sizeof(*result));
+    if (!result) return NULL;
+
+    result->capacity = 64;
+    result->buckets = calloc(result->capacity, sizeof(*result->buckets));
+    if (!result->buckets) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+void
+json_keys_free(struct json_keys *keys)
+{
+    if (!keys) return;
+
+    for (size_t i = 0; i < keys->capacity; i++) {
+        struct json_key_entry *entry = keys->buckets[i];
+        while (entry) {
+            struct json_key_entry *next = entry->chain;
+            entry->pool = NULL;
+            entry->chain = NULL;
+            entry = next;
+        }
+    }
+
+    if (json_parse_keys == keys)
+        json_parse_keys = NULL;
+
+    free(keys->buckets);
+    free(keys);
+}
+
+static bool
+keys_grow(struct json_keys *keys)
+{
+    size_t capacity = keys->capacity * 2;
+    struct json_key_entry **buckets = calloc(capacity, sizeof(*buckets));
+    if (!buckets) return false;
+
+    for (size_t i = 0; i < keys->capacity; i++) {
+        struct json_key_entry *entry = keys->buckets[i];
+        while (entry) {
+            struct json_key_entry *next = entry->chain;
+            size_t slot = entry->hash & (capacity - 1);
+            entry->chain = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+
+    free(keys->buckets);
+    keys->buckets = buckets;
+    keys->capacity = capacity;
+    return true;
+}
+
+/**
+ * Returns the pooled copy of a key, adding it if needed, and takes a
+ * reference to it on behalf of the caller.
+ */
+
+uint8_t *
+json_keys_intern(struct json_keys *keys, const uint8_t *text, size_t length,
+                 uint64_t hash)
+{
+    size_t slot = hash & (keys->capacity - 1);
+
+    for (struct json_key_entry *entry = keys->buckets[slot]; entry;
+         entry = entry->chain) {
+        if (entry->hash == hash && entry->length == length
+         && memcmp(entry->text, text, length) == 0) {
+            entry->refs++;
+            return entry->text;
+        }
+    }
+
+    if (keys->count >= keys->capacity && keys_grow(keys))
+        slot = hash & (keys->capacity - 1);
+
+    struct json_key_entry *entry = malloc(sizeof(*entry) + length + 1);
+    if (!entry) return NULL;
+
+    entry->pool = keys;
+    entry->hash = hash;
+    entry->length = length;
+    entry->refs = 1;
+    memcpy(entry->text, text, length);
+    entry->text[length] = '\0';
+
+    entry->chain = keys->buckets[slot];
+    keys->buckets[slot] = entry;
+    keys->count++;
+    return entry->text;
+}
+
+void
+json_keys_retain(uint8_t *text)
+{
+    key_entry(text)->refs++;
+}
+
+void
+json_keys_release(uint8_t *text)
+{
+    struct json_key_entry *entry = key_entry(text);
+    if (--entry->refs > 0) return;
+
+    struct json_keys *keys = entry->pool;
+    if (keys) {
+        struct json_key_entry **link = &keys->buckets[entry->hash & (keys->capacity - 1)];
+        while (*link != entry)
+            link = &(*link)->chain;
+        *link = entry->chain;
+        keys->count--;
+    }
+    free(entry);
+}
+
+/**
+ * Key handles.
+ *
+ * A handle from a pool takes a reference to the pooled key, so it stays
+ * valid even if every document using the key is freed in the meantime.  If
+ * the key cannot be added to the pool, the handle falls back to the caller's
+ * text, which still finds the key, only without the address comparison.
+ */
+
+struct json_key
+json_key(const uint8_t *key)
+{
+    struct json_key result = {
+        .text = key,
+        .hash = json_hash_bytes(key, strlen((const char *)key)),
+        .interned = false,
+    };
+    return result;
+}
+
+struct json_key
+json_key_in(struct json_keys *keys, const uint8_t *key)
+{
+    struct json_key result = json_key(key);
+    if (!keys) return result;
+
+    uint8_t *pooled = json_keys_intern(keys, key, strlen((const char *)key),
+                                       result.hash);
+    if (pooled) {
+        result.text = pooled;
+        result.interned = true;
+    }
+    return result;
+}
+
+void
+json_key_release(struct json_key *key)
+{
+    if (!key || !key->interned) return;
+
+    json_keys_release((uint8_t *)key->text);
+    key->text = NULL;
+    key->interned = false;
+}
+
+/**
+ * Parses the input stream, interning every object key in the given pool.
+ * Without a pool, a temporary one deduplicates keys within the document.
+ */
+
+struct json *
+json_parse_interned(FILE *in, struct json_keys *keys, enum json_status *status)
+{
+    struct json_keys *pool = keys ? keys : json_keys_new();
+    if (!pool) {
+        *status = JSON_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    struct json_keys *saved = json_parse_keys;
+    json_parse_keys = pool;
+    struct json *result = json_parse(in, status);
+    json_parse_keys = saved;
+
+    if (!keys) json_keys_free(pool);
+    return result;
+}
@@ -0,0 +1,512 @@
+/**
+ * MessagePack encoding and decoding.
+ *
+ * Every item starts with a marker byte.  Small integers, and the lengths of
+ * short strings, arrays and maps, are stored in the marker itself; other
+ * markers are followed by a big-endian integer, float, or length of 1, 2, 4,
+ * or 8 bytes.
+ *
+ * Numbers are written as the smallest integer format that holds them when
+ * they are integral and in range, and otherwise as a float32 if that is
+ * exact, or a float64.  The writer functions below are also public, so that
+ * a producer can stream MessagePack without building values first.
+ */
+
+#include "internal.h"
+#include "ustring.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Encoding.
+ */
+
+static void
+write_marker(FILE *out, uint8_t marker, uint64_t value, size_t size)
+{
+    uint8_t bytes[9];
+    bytes[0] = marker;
+    for (size_t i = size; i > 0; i--, value >>= 8)
+        bytes[i] = (uint8_t)value;
+    fwrite(bytes, 1, size + 1, out);
+}
+
+/**
+ * Writes the header of a string, array or map, whose short form holds a
+ * length below `limit` in the marker.
+ */
+
+static bool
+write_length(FILE *out, uint8_t fixed, size_t limit, uint8_t marker8,
+             uint8_t marker16, size_t length)
+{
+    if (length < limit)
+        write_marker(out, (uint8_t)(fixed | length), 0, 0);
+    else if (marker8 && length <= UINT8_MAX)
+        write_marker(out, marker8, length, 1);
+    else if (length <= UINT16_MAX)
+        write_marker(out, marker16, length, 2);
+    else if (length <= UINT32_MAX)
+        write_marker(out, marker16 + 1, length, 4);
+    else
+        return false;
+    return !ferror(out);
+}
+
+bool
+json_msgpack_null(FILE *out)
+{
+    fputc(0xC0, out);
+    return !ferror(out);
+}
+
+bool
+json_msgpack_boolean(FILE *out, bool value)
+{
+    fputc(value ? 0xC3 : 0xC2, out);
+    return !ferror(out);
+}
+
+bool
+json_msgpack_number(FILE *out, double number)
+{
+    if (number >= 0 && number < 18446744073709551616.0
+        && number == (uint64_t)number && !signbit(number)) {
+        uint64_t value = (uint64_t)number;
+        if (value <= 0x7F)            write_marker(out, (uint8_t)value, 0, 0);
+        else if (value <= UINT8_MAX)  write_marker(out, 0xCC, value, 1);
+        else if (value <= UINT16_MAX) write_marker(out, 0xCD, value, 2);
+        else if (value <= UINT32_MAX) write_marker(out, 0xCE, value, 4);
+        else                          write_marker(out, 0xCF, value, 8);
+    }
+    else if (number < 0 && number >= -9223372036854775808.0
+             && number == (int64_t)number) {
+        int64_t value = (int64_t)number;
+        if (value >= -32)             write_marker(out, (uint8_t)value, 0, 0);
+        else if (value >= INT8_MIN)   write_marker(out, 0xD0, (uint64_t)value, 1);
+        else if (value >= INT16_MIN)  write_marker(out, 0xD1, (uint64_t)value, 2);
+        else if (value >= INT32_MIN)  write_marker(out, 0xD2, (uint64_t)value, 4);
+        else                          write_marker(out, 0xD3, (uint64_t)value, 8);
+    }
+    else if (!isfinite(number)
+             || (fabs(number) <= 3.4028234663852886e38 && (double)(float)number == number)) {
+        float single = (float)number;
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        write_marker(out, 0xCA, bits, 4);
+    }
+    else {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        write_marker(out, 0xCB, bits, 8);
+    }
+    return !ferror(out);
+}
+
+bool
+json_msgpack_string(FILE *out, const uint8_t *text, size_t length)
+{
+    if (!write_length(out, 0xA0, 32, 0xD9, 0xDA, length)) return false;
+    fwrite(text, 1, length, out);
+    return !ferror(out);
+}
+
+bool
+json_msgpack_array(FILE *out, size_t count)
+{
+    return write_length(out, 0x90, 16, 0, 0xDC, count);
+}
+
+bool
+json_msgpack_map(FILE *out, size_t count)
+{
+    return write_length(out, 0x80, 16, 0, 0xDE, count);
+}
+
+bool
+json_to_msgpack(const struct json *json, FILE *out)
+{
+    if (!json || !json_resolve(json)) return false;
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT: {
+            const struct json_object *object = json->data.object;
+            if (!json_msgpack_map(out, object ? object->count : 0)) return false;
+
+            for (const struct json_member *member = object ? object->members : NULL;
+                 member; member = member->next) {
+                if (!json_msgpack_string(out, member->key, member->length)
+                    || !json_to_msgpack(member->value, out))
+                    return false;
+            }
+            return true;
+        }
+        case JSON_TYPE_ARRAY:
+            if (json->tag & JSON_TAG_PACKED) {
+                const struct json_numbers *numbers = json->data.numbers;
+                if (!json_msgpack_array(out, numbers->count)) return false;
+                for (size_t i = 0; i < numbers->count; i++) {
+                    if (!json_msgpack_number(out, numbers->values[i])) return false;
+                }
+            } else {
+                const struct json_array *array = json->data.array;
+                size_t count = array ? array->count : 0;
+                if (!json_msgpack_array(out, count)) return false;
+                for (size_t i = 0; i < count; i++) {
+                    if (!json_to_msgpack(array->items[i], out)) return false;
+                }
+            }
+            return true;
+        case JSON_TYPE_STRING: {
+            const uint8_t *text = json_string(json);
+            return json_msgpack_string(out, text, strlen((const char *)text));
+        }
+        case JSON_TYPE_NUMBER:
+            return json_msgpack_number(out, json->data.number);
+        case JSON_TYPE_BOOLEAN:
+            return json_msgpack_boolean(out, json->data.boolean);
+        case JSON_TYPE_NULL:
+            return json_msgpack_null(out);
+    }
+    return false;
+}
+
+/**
+ * Decoding.
+ *
+ * Items are read straight from the buffer, and strings are checked for
+ * UTF-8 and copied once into their nodes.  The lengths in array and map
+ * headers size arrays and object indexes before any element is read, and an
+ * array of numbers is decoded directly into packed storage.  Binary and
+ * extension data become base64url text, and non-finite floats become null.
+ */
+
+struct msgpack_reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    enum json_status status;
+    size_t depth;
+};
+
+static bool
+read_fail(struct msgpack_reader *reader, enum json_status status)
+{
+    if (reader->status == JSON_SUCCESS) reader->status = status;
+    return false;
+}
+
+static bool
+read_uint(struct msgpack_reader *reader, size_t size, uint64_t *value)
+{
+    if ((size_t)(reader->end - reader->p) < size)
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+
+    *value = 0;
+    for (size_t i = 0; i < size; i++)
+        *value = *value << 8 | *reader->p++;
+    return true;
+}
+
+static bool
+read_span(struct msgpack_reader *reader, uint64_t length, const uint8_t **bytes)
+{
+    if (length > (uint64_t)(reader->end - reader->p))
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+
+    *bytes = reader->p;
+    reader->p += length;
+    return true;
+}
+
+/**
+ * Reads a number if one comes next, without consuming anything or failing
+ * otherwise.
+ */
+
+static bool
+read_number(struct msgpack_reader *reader, double *number)
+{
+    if (reader->p >= reader->end) return false;
+
+    const uint8_t *start = reader->p;
+    enum json_status status = reader->status;
+    uint8_t marker = *reader->p++;
+    uint64_t value;
+
+    if (marker <= 0x7F || marker >= 0xE0) {
+        *number = (int8_t)marker;
+        return true;
+    }
+
+    switch (marker) {
+        case 0xCA: {
+            if (!read_uint(reader, 4, &value)) break;
+            uint32_t bits = (uint32_t)value;
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            *number = single;
+            if (isfinite(*number)) return true;
+            break;
+        }
+        case 0xCB:
+            if (!read_uint(reader, 8, &value)) break;
+            memcpy(number, &value, sizeof(*number));
+            if (isfinite(*number)) return true;
+            break;
+        case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+            if (!read_uint(reader, (size_t)1 << (marker - 0xCC), &value)) break;
+            *number = (double)value;
+            return true;
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3: {
+            size_t size = (size_t)1 << (marker - 0xD0);
+            if (!read_uint(reader, size, &value)) break;
+            if (size < 8 && (value >> (8 * size - 1)))
+                value |= ~(uint64_t)0 << (8 * size);
+            *number = (double)(int64_t)value;
+            return true;
+        }
+    }
+
+    reader->p = start;
+    reader->status = status;
+    return false;
+}
+
+/**
+ * Reads the header of a string, returning false if the next item is not
+ * one.
+ */
+
+static bool
+read_text(struct msgpack_reader *reader, const uint8_t **text, size_t *length)
+{
+    if (reader->p >= reader->end)
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+
+    uint8_t marker = *reader->p++;
+    uint64_t size;
+
+    if (marker >= 0xA0 && marker <= 0xBF)
+        size = marker & 0x1F;
+    else if (marker >= 0xD9 && marker <= 0xDB) {
+        if (!read_uint(reader, (size_t)1 << (marker - 0xD9), &size)) return false;
+    }
+    else
+        return read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+
+    if (!read_span(reader, size, text)) return false;
+    if (!valid_UTF8(*text, reader->p))
+        return read_fail(reader, JSON_INVALID_UNICODE);
+
+    *length = (size_t)size;
+    return true;
+}
+
+static struct json *read_item(struct msgpack_reader *reader);
+
+static bool
+read_array(struct msgpack_reader *reader, struct json *array, uint64_t count)
+{
+    if (count > (uint64_t)(reader->end - reader->p))
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+    if (count == 0) return true;
+
+    struct json_numbers *numbers = json_numbers_new(count);
+    if (!numbers) return false;
+
+    size_t read = 0;
+    while (read < count && read_number(reader, &numbers->values[read])) read++;
+
+    if (read == count) {
+        numbers->count = count;
+        array->data.numbers = numbers;
+        array->tag |= JSON_TAG_PACKED;
+        return true;
+    }
+
+    bool done = json_array_reserve(array, count);
+    for (size_t i = 0; i < read && done; i++) {
+        struct json *item = json_new_number(numbers->values[i]);
+        done = item && json_array_add(array, item);
+        if (item && !done) json_free(item);
+    }
+    free(numbers);
+
+    for (size_t i = read; i < count && done; i++) {
+        struct json *item = read_item(reader);
+        done = item && json_array_add(array, item);
+        if (item && !done) json_free(item);
+    }
+    return done;
+}
+
+/**
+ * Keys must be strings.  A repeated key replaces the earlier value, as it
+ * does when parsing text.
+ */
+
+static bool
+read_map(struct msgpack_reader *reader, struct json *object, uint64_t count)
+{
+    if (count > (uint64_t)(reader->end - reader->p) / 2)
+        return read_fail(reader, JSON_UNEXPECTED_FILE_END);
+    if (!json_object_reserve(object, (size_t)count)) return false;
+
+    for (uint64_t i = 0; i < count; i++) {
+        const uint8_t *key;
+        size_t length;
+        if (!read_text(reader, &key, &length)) return false;
+
+        struct json *value = read_item(reader);
+        struct json_member *member =
+            value ? json_member_make(key, length, value, NULL) : NULL;
+        if (!member) {
+            json_free(value);
+            return false;
+        }
+
+        struct json_member *existing =
+            json_object_find(object->data.object, member->key, member->hash);
+        if (existing) {
+            json_free(existing->value);
+            existing->value = member->value;
+            member->value = NULL;
+            json_member_free(member);
+        }
+        else if (!json_object_append(object, member)) {
+            json_member_free(member);
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct json *
+read_container(struct msgpack_reader *reader, bool map, uint64_t count)
+{
+    if (reader->depth >= JSON_MAX_DEPTH) {
+        read_fail(reader, JSON_NESTING_TOO_DEEP);
+        return NULL;
+    }
+
+    struct json *result = json_new_value(map ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY);
+    if (!result) return NULL;
+
+    reader->depth++;
+    bool done = map ? read_map(reader, result, count) : read_array(reader, result, count);
+    reader->depth--;
+
+    if (!done) {
+        json_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+/**
+ * Binary data is a length and the bytes; extension data adds a type byte
+ * between them, or has a fixed length given by the marker.
+ */
+
+static struct json *
+read_binary(struct msgpack_reader *reader, uint8_t marker)
+{
+    uint64_t length;
+    const uint8_t *bytes;
+
+    if (marker >= 0xD4)
+        length = (uint64_t)1 << (marker - 0xD4);
+    else if (!read_uint(reader, (size_t)1 << ((marker - 0xC4) % 3), &length))
+        return NULL;
+
+    if (marker >= 0xC7 && !read_span(reader, 1, &bytes)) return NULL;
+    if (!read_span(reader, length, &bytes)) return NULL;
+
+    struct json *result = json_new_value(JSON_TYPE_STRING);
+    if (result && !json_set_base64url(result, bytes, (size_t)length)) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+static struct json *
+read_item(struct msgpack_reader *reader)
+{
+    double number;
+    if (read_number(reader, &number)) return json_new_number(number);
+
+    if (reader->p >= reader->end) {
+        read_fail(reader, JSON_UNEXPECTED_FILE_END);
+        return NULL;
+    }
+
+    uint8_t marker = *reader->p;
+    uint64_t count;
+
+    if ((marker >= 0xA0 && marker <= 0xBF) || (marker >= 0xD9 && marker <= 0xDB)) {
+        const uint8_t *text;
+        size_t length;
+        if (!read_text(reader, &text, &length)) return NULL;
+
+        struct json *result = json_new_value(JSON_TYPE_STRING);
+        if (result && !json_set_string(result, text, length)) {
+            free(result);
+            return NULL;
+        }
+        return result;
+    }
+
+    reader->p++;
+    if (marker >= 0x80 && marker <= 0x9F)
+        return read_container(reader, marker <= 0x8F, marker & 0x0F);
+
+    switch (marker) {
+        case 0xC0:
+            return json_new_null();
+        case 0xCA:
+        case 0xCB:
+            if (!read_uint(reader, (marker == 0xCA) ? 4 : 8, &count)) return NULL;
+            return json_new_null();
+        case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+            read_fail(reader, JSON_UNEXPECTED_FILE_END);
+            return NULL;
+        case 0xC2:
+        case 0xC3:
+            return json_new_boolean(marker == 0xC3);
+        case 0xC4: case 0xC5: case 0xC6:
+        case 0xC7: case 0xC8: case 0xC9:
+        case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xD8:
+            return read_binary(reader, marker);
+        case 0xDC: case 0xDD:
+        case 0xDE: case 0xDF:
+            if (!read_uint(reader, (marker & 1) ? 4 : 2, &count)) return NULL;
+            return read_container(reader, marker >= 0xDE, count);
+        default:
+            read_fail(reader, JSON_UNEXPECTED_CHARACTER);
+            return NULL;
+    }
+}
+
+struct json *
+json_from_msgpack(const uint8_t *buffer, size_t length, enum json_status *status)
+{
+    struct msgpack_reader reader = { buffer, buffer + length, JSON_SUCCESS, 0 };
+
+    struct json *result = read_item(&reader);
+    if (result && reader.p != reader.end) {
+        read_fail(&reader, JSON_UNEXPECTED_CHARACTER);
+        json_free(result);
+        result = NULL;
+    }
+
+    /* Reading fails without a status only when an allocation does. */
+    if (!result && reader.status == JSON_SUCCESS)
+        reader.status = JSON_OUT_OF_MEMORY;
+
+    if (status) *status = reader.status;
+    return result;
+}
@@ -0,0 +1,148 @@
+/**
+ * Fast conversion of JSON numbers.
+ *
+ * Most numbers in real documents have few significant digits and a small
+ * exponent.  For those, the decimal significand fits exactly in a double and
+ * a single multiplication or division by an exact power of ten gives the
+ * correctly rounded result, so strtod is not needed.  Digits are converted
+ * eight at a time using 64-bit word arithmetic.  Numbers outside the fast
+ * path are left to the caller, which falls back to strtod.
+ */
+
+#include "internal.h"
+
+#include <float.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMBER_WORDS 1
+#else
+#define NUMBER_WORDS 0
+#endif
+
+static const double powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Tests whether all eight bytes of a word, loaded in memory order, are ASCII
+ * digits, and converts them to their value.
+ */
+
+static bool
+eight_digits(uint64_t word)
+{
+    return ((word & 0xF0F0F0F0F0F0F0F0ULL)
+          | (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+        == 0x3333333333333333ULL;
+}
+
+static uint32_t
+eight_digits_value(uint64_t word)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    word -= 0x3030303030303030ULL;
+    word = (word * 10) + (word >> 8);
+    word = (((word & mask) * mul1) + (((word >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)word;
+}
+
+/**
+ * Accumulates a run of digits into the significand.  Returns false once more
+ * than 19 digits have been read, as the significand could then overflow.
+ */
+
+static bool
+read_digits(const uint8_t **cursor, const uint8_t *end, uint64_t *significand,
+            int *digits)
+{
+    const uint8_t *p = *cursor;
+    uint64_t value = *significand;
+    int count = *digits;
+
+#if NUMBER_WORDS
+    while (end - p >= 8 && count <= 11) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        if (!eight_digits(word)) break;
+
+        value = value * 100000000 + eight_digits_value(word);
+        count += 8;
+        p += 8;
+    }
+#endif
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (++count > 19) return false;
+        value = value * 10 + (*p++ - '0');
+    }
+
+    *cursor = p;
+    *significand = value;
+    *digits = count;
+    return true;
+}
+
+/**
+ * Converts a number lexeme already validated as JSON.  Returns false, without
+ * storing a value, if the number is outside the fast path.
+ */
+
+bool
+json_number_exact(const uint8_t *text, size_t length, double *value)
+{
+#if FLT_EVAL_METHOD == 0
+    const uint8_t *p = text;
+    const uint8_t *end = text + length;
+
+    bool negative = (p < end && *p == '-');
+    if (negative) p++;
+
+    uint64_t significand = 0;
+    int digits = 0;
+    int exponent = 0;
+
+    if (!read_digits(&p, end, &significand, &digits)) return false;
+
+    if (p < end && *p == '.') {
+        const uint8_t *fraction = ++p;
+        if (!read_digits(&p, end, &significand, &digits)) return false;
+        exponent -= (int)(p - fraction);
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool minus = (p < end && *p == '-');
+        if (p < end && (*p == '-' || *p == '+')) p++;
+
+        int written = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (written > 1000) return false;
+            written = written * 10 + (*p++ - '0');
+        }
+        exponent += minus ? -written : written;
+    }
+
+    if (p != end) return false;
+    if (significand > ((uint64_t)1 << 53)) return false;
+    if (exponent < -22 || exponent > 22) return false;
+
+    double result = (double)significand;
+    if (exponent < 0)
+        result /= powers_of_ten[-exponent];
+    else
+        result *= powers_of_ten[exponent];
+
+    *value = negative ? -result : result;
+    return true;
+#else
+    (void)text;
+    (void)length;
+    (void)value;
+    return false;
+#endif
+}
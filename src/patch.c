@@ -0,0 +1,293 @@
+/**
+ * JSON Merge Patch (RFC 7396) and JSON Patch (RFC 6902).
+ *
+ * Both are applied to the target in place.  Members are found through the
+ * object index and elements are inserted and removed by splicing, so the
+ * cost of a patch depends on the size of the patch and not of the document.
+ * A value that must be replaced wholesale, including the root, is swapped
+ * into the existing node, so that the node stays where its parent, or the
+ * caller, holds it.
+ */
+
+#include "internal.h"
+
+#include <string.h>
+
+/**
+ * Replaces the contents of `target` with those of `value`, which is consumed.
+ */
+
+static bool
+node_replace(struct json *target, struct json *value)
+{
+    if (json_is_frozen(target)) {
+        json_free(value);
+        return false;
+    }
+
+    struct json swap = *target;
+    *target = *value;
+    *value = swap;
+    json_free(value);
+    return true;
+}
+
+/**
+ * Merge Patch.
+ *
+ * A patch that is not an object replaces the target.  Otherwise each of its
+ * members removes the target's member when null, and is merged into it
+ * otherwise, starting from nothing for members the target lacks, which
+ * drops the nulls nested in them.  Removing a member the target lacks does
+ * nothing, so a frozen target is refused before any member is looked at.
+ */
+
+bool
+json_merge_patch(struct json *target, const struct json *patch)
+{
+    if (!target || !patch || json_is_frozen(target)) return false;
+
+    if (json_type(patch) != JSON_TYPE_OBJECT) {
+        struct json *copy = json_clone(patch);
+        return copy && node_replace(target, copy);
+    }
+
+    if (json_type(target) != JSON_TYPE_OBJECT) {
+        struct json *object = json_new_object();
+        if (!object || !node_replace(target, object)) return false;
+    }
+
+    struct json_object_iter iter;
+    const uint8_t *key;
+    size_t length;
+    struct json *value;
+    json_object_iter_begin(patch, &iter);
+
+    while (json_object_iter_next(&iter, &key, &length, &value)) {
+        if (json_type(value) == JSON_TYPE_NULL) {
+            json_object_remove(target, key);
+            continue;
+        }
+
+        struct json *member = json_object_get(target, key);
+        if (member) {
+            if (!json_merge_patch(member, value)) return false;
+            continue;
+        }
+
+        struct json *added = json_new_null();
+        if (!added) return false;
+
+        if (!json_merge_patch(added, value) || !json_object_add(target, key, added)) {
+            json_free(added);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * JSON Patch.
+ *
+ * Locations are JSON Pointers.  Adding or removing works on the container
+ * holding the location, found by following every token but the last; the
+ * last token names a member, an element index, or `-` for the end of an
+ * array.
+ */
+
+/**
+ * Adds `value` at `path`, or returns false and leaves the value to the caller.
+ */
+
+static bool
+patch_insert(struct json *json, const struct json_pointer *path, struct json *value)
+{
+    if (path->count == 0)
+        return !json_is_frozen(json) && node_replace(json, value);
+
+    struct json *parent = json_pointer_walk(json, path, path->count - 1);
+    const struct json_pointer_token *last = &path->tokens[path->count - 1];
+
+    bool added = false;
+    switch (parent ? json_type(parent) : JSON_TYPE_NULL) {
+        case JSON_TYPE_OBJECT:
+            added = json_object_add(parent, last->key, value);
+            break;
+        case JSON_TYPE_ARRAY: {
+            size_t length = json_array_length(parent);
+            size_t index = (last->length == 1 && last->key[0] == '-')
+                         ? length : last->index;
+            added = index <= length && json_array_insert(parent, index, value);
+            break;
+        }
+        default:
+            break;
+    }
+    return added;
+}
+
+static bool
+patch_add(struct json *json, const struct json_pointer *path, struct json *value)
+{
+    if (patch_insert(json, path, value)) return true;
+
+    json_free(value);
+    return false;
+}
+
+static bool
+patch_remove(struct json *json, const struct json_pointer *path)
+{
+    if (path->count == 0) return false;
+
+    struct json *parent = json_pointer_walk(json, path, path->count - 1);
+    const struct json_pointer_token *last = &path->tokens[path->count - 1];
+
+    switch (parent ? json_type(parent) : JSON_TYPE_NULL) {
+        case JSON_TYPE_OBJECT:
+            return json_object_remove(parent, last->key);
+        case JSON_TYPE_ARRAY:
+            return last->index < json_array_length(parent)
+                && json_array_remove(parent, last->index);
+        default:
+            return false;
+    }
+}
+
+static bool
+pointer_contains(const struct json_pointer *outer, const struct json_pointer *inner)
+{
+    if (outer->count > inner->count) return false;
+
+    for (size_t i = 0; i < outer->count; i++) {
+        const struct json_pointer_token *a = &outer->tokens[i];
+        const struct json_pointer_token *b = &inner->tokens[i];
+        if (a->length != b->length || memcmp(a->key, b->key, a->length) != 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * A moved value is detached by swapping it with a null, so the value itself
+ * is never copied, and a move that fails leaves it where it was.
+ *
+ * A member of an object is removed only once the value has been added, as
+ * its presence cannot change where the destination is, unless the
+ * destination encloses it.  An element of an array is removed first, since
+ * that shifts the indexes after it, and is inserted back if the value cannot
+ * be added.
+ */
+
+static bool
+patch_move(struct json *json, const struct json_pointer *from,
+           const struct json_pointer *path)
+{
+    if (pointer_contains(from, path))
+        return from->count == path->count && json_pointer_get(json, from);
+
+    struct json *source = json_pointer_walk(json, from, from->count);
+    if (!source || json_is_frozen(source)) return false;
+
+    struct json *parent = json_pointer_walk(json, from, from->count - 1);
+    const struct json_pointer_token *last = &from->tokens[from->count - 1];
+
+    struct json *moved = json_new_null();
+    if (!moved) return false;
+
+    struct json swap = *source;
+    *source = *moved;
+    *moved = swap;
+
+    if (json_type(parent) == JSON_TYPE_OBJECT && !pointer_contains(path, from)) {
+        if (!patch_insert(json, path, moved)) {
+            *moved = *source;
+            *source = swap;
+            json_free(moved);
+            return false;
+        }
+        return json_object_remove(parent, last->key);
+    }
+
+    if (!patch_remove(json, from)) {
+        *moved = *source;
+        *source = swap;
+        json_free(moved);
+        return false;
+    }
+    if (patch_insert(json, path, moved)) return true;
+
+    if (!patch_insert(json, from, moved)) json_free(moved);
+    return false;
+}
+
+static const uint8_t *
+op_string(const struct json *op, const char *name)
+{
+    struct json *value = json_object_get(op, (const uint8_t *)name);
+    return (value && json_type(value) == JSON_TYPE_STRING) ? json_get_string(value) : NULL;
+}
+
+static bool
+patch_operation(struct json *json, const struct json *op)
+{
+    const uint8_t *name = op_string(op, "op");
+    const uint8_t *text = op_string(op, "path");
+    const uint8_t *from_text = op_string(op, "from");
+    struct json *value = json_object_get(op, (const uint8_t *)"value");
+
+    if (!name || !text) return false;
+
+    struct json_pointer *path = json_pointer_compile(text);
+    struct json_pointer *from = from_text ? json_pointer_compile(from_text) : NULL;
+    if (!path || (from_text && !from)) {
+        json_pointer_free(path);
+        json_pointer_free(from);
+        return false;
+    }
+
+    const char *kind = (const char *)name;
+    bool applied = false;
+
+    if (strcmp(kind, "add") == 0) {
+        struct json *copy = value ? json_clone(value) : NULL;
+        applied = copy && patch_add(json, path, copy);
+    }
+    else if (strcmp(kind, "remove") == 0) {
+        applied = patch_remove(json, path);
+    }
+    else if (strcmp(kind, "replace") == 0) {
+        struct json *target = json_pointer_walk(json, path, path->count);
+        struct json *copy = (target && value) ? json_clone(value) : NULL;
+        applied = copy && node_replace(target, copy);
+    }
+    else if (strcmp(kind, "move") == 0) {
+        applied = from && patch_move(json, from, path);
+    }
+    else if (strcmp(kind, "copy") == 0) {
+        struct json *source = from ? json_pointer_get(json, from) : NULL;
+        struct json *copy = source ? json_clone(source) : NULL;
+        applied = copy && patch_add(json, path, copy);
+    }
+    else if (strcmp(kind, "test") == 0) {
+        applied = value && json_equal(json_pointer_get(json, path), value);
+    }
+
+    json_pointer_free(path);
+    json_pointer_free(from);
+    return applied;
+}
+
+bool
+json_patch_apply(struct json *json, const struct json *ops)
+{
+    if (!json || !ops || json_type(ops) != JSON_TYPE_ARRAY) return false;
+
+    size_t count = json_array_length(ops);
+    for (size_t i = 0; i < count; i++) {
+        const struct json *op = json_array_get(ops, i);
+        if (!op || json_type(op) != JSON_TYPE_OBJECT || !patch_operation(json, op))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,895 @@
+/**
+ * JSONPath queries.
+ *
+ * A query is compiled into a program of steps, one per selector:
+ *
+ *   .name  ['name']      member with the given key
+ *   .*  [*]              every member or element
+ *   [n]                  element n, counted from the end if negative
+ *   [start:end:step]     elements of a slice
+ *   [?(@.a.b op value)]  members or elements for which a comparison holds,
+ *                        or [?(@.a.b)] for which the relative path exists
+ *
+ * and `..` before a selector applies it at every depth below.  Programs are
+ * run against values one container at a time.  The set of steps still to be
+ * matched at a container is a bit mask, and each child advances the mask by
+ * the steps its key or index satisfies, so one walk over the document
+ * evaluates every branch of the query at once.
+ *
+ * The same walk runs over a tree or over the events of the in-memory reader.
+ * When streaming, no values are created except those matched by the query,
+ * and the children of containers where a filter must inspect them.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_MAX_STEPS 63
+
+enum path_op {
+    PATH_NAME,
+    PATH_WILDCARD,
+    PATH_INDEX,
+    PATH_SLICE,
+    PATH_FILTER
+};
+
+struct path_filter {
+    struct json_pointer *target;
+    enum json_compare compare;
+    struct json *literal;
+};
+
+struct path_step {
+    enum path_op op;
+    bool descend;
+
+    uint8_t *name;
+    size_t length;
+
+    int64_t start;
+    int64_t end;
+    int64_t stride;
+    bool has_start;
+    bool has_end;
+
+    struct path_filter filter;
+};
+
+struct json_path {
+    size_t count;
+    bool needs_length;
+    uint64_t filters;
+    struct path_step steps[PATH_MAX_STEPS];
+};
+
+/**
+ * Compiling queries.
+ */
+
+struct path_parser {
+    const uint8_t *p;
+};
+
+static bool
+is_name_char(uint8_t c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '$'
+        || c >= 0x80;
+}
+
+static uint8_t *
+copy_bytes(const uint8_t *start, size_t length)
+{
+    uint8_t *copy = malloc(length + 1);
+    if (!copy) return NULL;
+
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static bool
+parse_name(struct path_parser *parser, uint8_t **name, size_t *length)
+{
+    const uint8_t *start = parser->p;
+    while (is_name_char(*parser->p)) parser->p++;
+
+    *length = parser->p - start;
+    if (*length == 0) return false;
+
+    *name = copy_bytes(start, *length);
+    return *name != NULL;
+}
+
+/**
+ * Quoted names use single or double quotes, with a backslash escaping the
+ * next character.
+ */
+
+static bool
+parse_quoted(struct path_parser *parser, uint8_t **name, size_t *length)
+{
+    uint8_t quote = *parser->p++;
+    const uint8_t *start = parser->p;
+
+    size_t size = 0;
+    for (const uint8_t *p = start; *p != quote; p++, size++) {
+        if (*p == '\0') return false;
+        if (*p == '\\' && *++p == '\0') return false;
+    }
+
+    uint8_t *result = malloc(size + 1);
+    if (!result) return false;
+
+    size_t n = 0;
+    while (*parser->p != quote) {
+        if (*parser->p == '\\') parser->p++;
+        result[n++] = *parser->p++;
+    }
+    parser->p++;
+
+    result[n] = '\0';
+    *name = result;
+    *length = n;
+    return true;
+}
+
+static bool
+parse_integer(struct path_parser *parser, int64_t *value)
+{
+    const uint8_t *p = parser->p;
+    bool negative = (*p == '-');
+    if (negative) p++;
+    if (*p < '0' || *p > '9') return false;
+
+    int64_t result = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        if (result > (INT64_MAX - 9) / 10) return false;
+        result = result * 10 + (*p - '0');
+    }
+
+    parser->p = p;
+    *value = negative ? -result : result;
+    return true;
+}
+
+static struct json *
+parse_literal(struct path_parser *parser)
+{
+    const uint8_t *p = parser->p;
+
+    if (*p == '\'' || *p == '"') {
+        uint8_t *text;
+        size_t length;
+        if (!parse_quoted(parser, &text, &length)) return NULL;
+
+        struct json *result = json_new_string(text);
+        free(text);
+        return result;
+    }
+
+    static const struct { const char *word; int type; } words[] = {
+        { "true", 1 }, { "false", 0 }, { "null", -1 }
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(*words); i++) {
+        size_t length = strlen(words[i].word);
+        if (strncmp((const char *)p, words[i].word, length) == 0) {
+            parser->p += length;
+            return (words[i].type < 0) ? json_new_null()
+                                       : json_new_boolean(words[i].type);
+        }
+    }
+
+    const uint8_t *end = p;
+    if (*end == '-') end++;
+    while ((*end >= '0' && *end <= '9') || *end == '.' || *end == 'e'
+        || *end == 'E' || *end == '+' || *end == '-')
+        end++;
+    if (end == p) return NULL;
+
+    parser->p = end;
+    return json_new_number(json_read_number(p, end - p));
+}
+
+/**
+ * Parses a filter such as `?(@.price < 10)`.  The relative path is converted
+ * to a JSON Pointer and evaluated with json_pointer_get.
+ */
+
+static bool
+parse_filter(struct path_parser *parser, struct path_filter *filter)
+{
+    bool parenthesized = (*parser->p == '(');
+    if (parenthesized) parser->p++;
+    parser->p = json_skip_space(parser->p);
+
+    if (*parser->p++ != '@') return false;
+
+    size_t capacity = 64, size = 0;
+    uint8_t *pointer = malloc(capacity);
+    if (!pointer) return false;
+
+    for (;;) {
+        uint8_t *name = NULL;
+        size_t length = 0;
+
+        if (*parser->p == '.' && is_name_char(parser->p[1])) {
+            parser->p++;
+            if (!parse_name(parser, &name, &length)) break;
+        }
+        else if (*parser->p == '[' && (parser->p[1] == '\'' || parser->p[1] == '"')) {
+            parser->p++;
+            if (!parse_quoted(parser, &name, &length) || *parser->p++ != ']') {
+                free(name);
+                break;
+            }
+        }
+        else if (*parser->p == '[') {
+            parser->p++;
+            int64_t index;
+            if (!parse_integer(parser, &index) || index < 0 || *parser->p++ != ']')
+                break;
+
+            char digits[24];
+            length = (size_t)snprintf(digits, sizeof(digits), "%lld", (long long)index);
+            name = copy_bytes((const uint8_t *)digits, length);
+            if (!name) break;
+        }
+        else {
+            pointer[size] = '\0';
+            filter->target = json_pointer_compile(pointer);
+            free(pointer);
+            pointer = NULL;
+            break;
+        }
+
+        while (size + 2 * length + 2 > capacity) {
+            capacity *= 2;
+            uint8_t *resized = realloc(pointer, capacity);
+            if (!resized) {
+                free(name);
+                free(pointer);
+                return false;
+            }
+            pointer = resized;
+        }
+
+        pointer[size++] = '/';
+        for (size_t i = 0; i < length; i++) {
+            if (name[i] == '~' || name[i] == '/') {
+                pointer[size++] = '~';
+                pointer[size++] = (name[i] == '~') ? '0' : '1';
+            } else {
+                pointer[size++] = name[i];
+            }
+        }
+        free(name);
+    }
+
+    if (pointer) {
+        free(pointer);
+        return false;
+    }
+    if (!filter->target) return false;
+
+    parser->p = json_skip_space(parser->p);
+    filter->compare = json_parse_compare(&parser->p);
+    if (filter->compare != JSON_COMPARE_NONE) {
+        parser->p = json_skip_space(parser->p);
+        filter->literal = parse_literal(parser);
+        if (!filter->literal) return false;
+    }
+
+    parser->p = json_skip_space(parser->p);
+    if (parenthesized && *parser->p++ != ')') return false;
+    return true;
+}
+
+static bool
+parse_bracket(struct path_parser *parser, struct path_step *step)
+{
+    parser->p = json_skip_space(parser->p);
+    uint8_t c = *parser->p;
+
+    if (c == '*') {
+        parser->p++;
+        step->op = PATH_WILDCARD;
+    }
+    else if (c == '\'' || c == '"') {
+        step->op = PATH_NAME;
+        if (!parse_quoted(parser, &step->name, &step->length)) return false;
+    }
+    else if (c == '?') {
+        parser->p++;
+        step->op = PATH_FILTER;
+        if (!parse_filter(parser, &step->filter)) return false;
+    }
+    else {
+        step->has_start = parse_integer(parser, &step->start);
+        parser->p = json_skip_space(parser->p);
+
+        if (*parser->p != ':') {
+            if (!step->has_start) return false;
+            step->op = PATH_INDEX;
+        } else {
+            parser->p++;
+            parser->p = json_skip_space(parser->p);
+            step->op = PATH_SLICE;
+            step->has_end = parse_integer(parser, &step->end);
+            step->stride = 1;
+
+            parser->p = json_skip_space(parser->p);
+            if (*parser->p == ':') {
+                parser->p++;
+                parser->p = json_skip_space(parser->p);
+                if (!parse_integer(parser, &step->stride))
+                    step->stride = 1;
+            }
+        }
+    }
+
+    parser->p = json_skip_space(parser->p);
+    return *parser->p++ == ']';
+}
+
+static bool
+parse_member(struct path_parser *parser, struct path_step *step)
+{
+    if (*parser->p == '*') {
+        parser->p++;
+        step->op = PATH_WILDCARD;
+        return true;
+    }
+
+    step->op = PATH_NAME;
+    return parse_name(parser, &step->name, &step->length);
+}
+
+/**
+ * Steps that count from the end of an array need its length, which is not
+ * known while streaming.
+ */
+
+static bool
+needs_length(const struct path_step *step)
+{
+    switch (step->op) {
+        case PATH_INDEX:
+            return step->start < 0;
+        case PATH_SLICE:
+            return step->stride <= 0
+                || (step->has_start && step->start < 0)
+                || (step->has_end && step->end < 0);
+        default:
+            return false;
+    }
+}
+
+struct json_path *
+json_path_compile(const uint8_t *text)
+{
+    if (!text || *text != '$') return NULL;
+
+    struct json_path *path = calloc(1, sizeof(*path));
+    if (!path) return NULL;
+
+    struct path_parser parser = { text + 1 };
+
+    while (*parser.p) {
+        if (path->count == PATH_MAX_STEPS) goto fail;
+
+        struct path_step *step = &path->steps[path->count++];
+
+        if (parser.p[0] == '.' && parser.p[1] == '.') {
+            step->descend = true;
+            parser.p++;
+            if (parser.p[1] == '[') parser.p++;
+        }
+
+        bool valid;
+        if (*parser.p == '.') {
+            parser.p++;
+            valid = parse_member(&parser, step);
+        } else if (*parser.p == '[') {
+            parser.p++;
+            valid = parse_bracket(&parser, step);
+        } else {
+            valid = false;
+        }
+        if (!valid) goto fail;
+
+        if (step->op == PATH_FILTER)
+            path->filters |= (uint64_t)1 << (path->count - 1);
+        if (needs_length(step))
+            path->needs_length = true;
+    }
+    return path;
+
+fail:
+    json_path_free(path);
+    return NULL;
+}
+
+void
+json_path_free(struct json_path *path)
+{
+    if (!path) return;
+
+    for (size_t i = 0; i < path->count; i++) {
+        free(path->steps[i].name);
+        json_pointer_free(path->steps[i].filter.target);
+        json_free(path->steps[i].filter.literal);
+    }
+    free(path);
+}
+
+/**
+ * Matching children against steps.
+ *
+ * A child is identified by its key, or by its index within an array whose
+ * length is SIZE_MAX when unknown.  The child itself is only needed by
+ * filters.
+ */
+
+struct path_child {
+    const uint8_t *key;
+    size_t length;
+    size_t index;
+    size_t count;
+};
+
+static bool
+index_matches(const struct path_step *step, size_t index, size_t count)
+{
+    int64_t n = (count == SIZE_MAX) ? INT64_MAX : (int64_t)count;
+    int64_t i = (int64_t)index;
+
+    if (step->op == PATH_INDEX)
+        return (step->start < 0) ? (i == n + step->start) : (i == step->start);
+
+    if (step->stride == 0) return false;
+
+    int64_t start = step->start;
+    int64_t end = step->end;
+    if (start < 0) start += n;
+    if (end < 0) end += n;
+
+    if (step->stride > 0) {
+        int64_t lower = step->has_start ? (start < 0 ? 0 : start) : 0;
+        int64_t upper = step->has_end ? end : n;
+        return i >= lower && i < upper && (i - lower) % step->stride == 0;
+    }
+
+    int64_t upper = step->has_start ? (start >= n ? n - 1 : start) : n - 1;
+    int64_t lower = step->has_end ? (end < -1 ? -1 : end) : -1;
+    return i > lower && i <= upper && (upper - i) % -step->stride == 0;
+}
+
+static bool
+filter_matches(const struct path_filter *filter, const struct json *value)
+{
+    const struct json *target = json_pointer_get(value, filter->target);
+
+    if (filter->compare == JSON_COMPARE_NONE) return target != NULL;
+    if (!target) return filter->compare == JSON_COMPARE_NOT_EQUAL;
+
+    const struct json *literal = filter->literal;
+
+    switch (filter->compare) {
+        case JSON_COMPARE_EQUAL:     return json_equal(target, literal);
+        case JSON_COMPARE_NOT_EQUAL: return !json_equal(target, literal);
+        default:                     break;
+    }
+
+    int order;
+    if (json_type(target) == JSON_TYPE_NUMBER && json_type(literal) == JSON_TYPE_NUMBER) {
+        double a = json_get_number(target), b = json_get_number(literal);
+        order = (a > b) - (a < b);
+    }
+    else if (json_type(target) == JSON_TYPE_STRING && json_type(literal) == JSON_TYPE_STRING) {
+        order = strcmp((const char *)json_get_string(target),
+                       (const char *)json_get_string(literal));
+    }
+    else {
+        return false;
+    }
+    return json_compare_order(filter->compare, order);
+}
+
+static bool
+step_matches(const struct path_step *step, const struct path_child *child,
+             const struct json *value)
+{
+    switch (step->op) {
+        case PATH_NAME:
+            return child->key && child->length == step->length
+                && memcmp(child->key, step->name, step->length) == 0;
+        case PATH_WILDCARD:
+            return true;
+        case PATH_INDEX:
+        case PATH_SLICE:
+            return !child->key && index_matches(step, child->index, child->count);
+        case PATH_FILTER:
+            return value && filter_matches(&step->filter, value);
+    }
+    return false;
+}
+
+/**
+ * Advances the steps pending at a container to one of its children.  Sets
+ * `matched` if the child completes the query, and returns the steps pending
+ * at the child.
+ */
+
+static uint64_t
+path_advance(const struct json_path *path, uint64_t states,
+             const struct path_child *child, const struct json *value,
+             bool *matched)
+{
+    uint64_t next = 0;
+    *matched = false;
+
+    for (size_t i = 0; states; i++, states >>= 1) {
+        if (!(states & 1)) continue;
+
+        const struct path_step *step = &path->steps[i];
+        if (step_matches(step, child, value)) {
+            if (i + 1 == path->count)
+                *matched = true;
+            else
+                next |= (uint64_t)1 << (i + 1);
+        }
+        if (step->descend)
+            next |= (uint64_t)1 << i;
+    }
+    return next;
+}
+
+/**
+ * Evaluation over a tree.
+ */
+
+struct path_query {
+    const struct json_path *path;
+    bool (*visit)(void *context, const struct json *value);
+    void *context;
+    size_t matches;
+    bool stopped;
+};
+
+static bool tree_visit(struct path_query *query, const struct json *json,
+                       uint64_t states);
+
+static bool
+tree_child(struct path_query *query, uint64_t states,
+           const struct path_child *child, const struct json *value)
+{
+    bool matched;
+    uint64_t next = path_advance(query->path, states, child, value, &matched);
+
+    if (matched) {
+        query->matches++;
+        if (!query->visit(query->context, value)) {
+            query->stopped = true;
+            return false;
+        }
+    }
+    return !next || tree_visit(query, value, next);
+}
+
+static bool
+tree_visit(struct path_query *query, const struct json *json, uint64_t states)
+{
+    struct path_child child = { NULL, 0, 0, 0 };
+
+    switch (json_type(json)) {
+        case JSON_TYPE_OBJECT: {
+            struct json_object_iter iter;
+            struct json *value;
+            json_object_iter_begin(json, &iter);
+
+            while (json_object_iter_next(&iter, &child.key, &child.length, &value)) {
+                if (!tree_child(query, states, &child, value)) return false;
+            }
+            return true;
+        }
+        case JSON_TYPE_ARRAY:
+            child.count = json_array_length(json);
+            for (child.index = 0; child.index < child.count; child.index++) {
+                struct json *value = json_array_get(json, child.index);
+                if (!tree_child(query, states, &child, value)) return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+size_t
+json_path_select(const struct json *json, const struct json_path *path,
+                 bool (*visit)(void *context, const struct json *value),
+                 void *context)
+{
+    if (!json || !path) return 0;
+
+    struct path_query query = { path, visit, context, 0, false };
+
+    if (path->count == 0) {
+        query.matches++;
+        visit(context, json);
+    } else {
+        tree_visit(&query, json, 1);
+    }
+    return query.matches;
+}
+
+/**
+ * Evaluation while streaming.
+ *
+ * Each open container keeps the steps pending at it.  A child that matches
+ * the query, or that a filter must inspect, is captured: the reader walks it
+ * as usual while its extent is recorded, and the child alone is then opened
+ * as an on-demand document and handed to the tree evaluation above.
+ */
+
+struct path_frame {
+    uint64_t states;
+    size_t index;
+    bool array;
+};
+
+struct path_stream {
+    struct path_query query;
+
+    size_t depth;
+    struct path_frame frames[JSON_MAX_DEPTH + 1];
+
+    const uint8_t *key;
+    size_t key_length;
+    uint8_t *decoded;
+
+    size_t captured;
+    const uint8_t *capture;
+    uint64_t capture_states;
+    struct path_child capture_child;
+    uint8_t *capture_key;
+};
+
+/**
+ * Hands a captured value, already validated by the walk, to the query.  The
+ * root is matched directly when the query has no steps.  A document is
+ * opened over the value, which can then fail only if memory runs out.
+ */
+
+static bool
+stream_root(struct path_stream *stream, const uint8_t *text, size_t length)
+{
+    enum json_status status;
+    struct json_doc *doc = json_doc_open(text, length, &status);
+    if (!doc) return false;
+
+    stream->query.matches++;
+    bool more = stream->query.visit(stream->query.context, json_doc_root(doc));
+    json_doc_close(doc);
+
+    if (!more) stream->query.stopped = true;
+    return more;
+}
+
+static bool
+stream_deliver(struct path_stream *stream, const uint8_t *text, size_t length,
+               uint64_t states, const struct path_child *child)
+{
+    enum json_status status;
+    struct json_doc *doc = json_doc_open(text, length, &status);
+    if (!doc) return false;
+
+    bool more = tree_child(&stream->query, states, child, json_doc_root(doc));
+    json_doc_close(doc);
+    return more;
+}
+
+/**
+ * Starts a value inside the current container.  Returns the steps pending at
+ * it when it is a container to be streamed, and sets `capture` if the value
+ * must be captured instead.
+ */
+
+static uint64_t
+stream_value(struct path_stream *stream, struct path_child *child,
+             bool *capture)
+{
+    *capture = false;
+
+    if (stream->depth == 0) {
+        child->key = NULL;
+        child->count = SIZE_MAX;
+        if (stream->query.path->count == 0) {
+            *capture = true;
+            return 0;
+        }
+        return 1;
+    }
+
+    struct path_frame *frame = &stream->frames[stream->depth];
+    uint64_t states = frame->states;
+    if (!states) return 0;
+
+    if (frame->array) {
+        child->key = NULL;
+        child->index = frame->index;
+    } else {
+        child->key = stream->key;
+        child->length = stream->key_length;
+    }
+    child->count = SIZE_MAX;
+
+    if (states & stream->query.path->filters) {
+        *capture = true;
+        return 0;
+    }
+
+    bool matched;
+    uint64_t next = path_advance(stream->query.path, states, child, NULL, &matched);
+    *capture = matched;
+    return next;
+}
+
+static void
+stream_count(struct path_stream *stream)
+{
+    if (stream->depth > 0) stream->frames[stream->depth].index++;
+}
+
+static bool
+stream_begin(void *context, const uint8_t *at)
+{
+    struct path_stream *stream = context;
+
+    if (stream->captured) {
+        stream->captured++;
+        return true;
+    }
+
+    struct path_child child = { 0 };
+    bool capture;
+    uint64_t states = stream_value(stream, &child, &capture);
+    uint64_t parent = stream->depth ? stream->frames[stream->depth].states : 1;
+    stream_count(stream);
+
+    if (capture) {
+        stream->captured = 1;
+        stream->capture = at;
+        stream->capture_states = parent;
+        stream->capture_child = child;
+
+        if (child.key) {
+            stream->capture_key = malloc(child.length + 1);
+            if (!stream->capture_key) return false;
+            memcpy(stream->capture_key, child.key, child.length);
+            stream->capture_child.key = stream->capture_key;
+        }
+        return true;
+    }
+
+    struct path_frame *frame = &stream->frames[++stream->depth];
+    frame->states = states;
+    frame->index = 0;
+    frame->array = (*at == '[');
+    return true;
+}
+
+static bool
+stream_end(void *context, const uint8_t *at)
+{
+    struct path_stream *stream = context;
+
+    if (!stream->captured) {
+        stream->depth--;
+        return true;
+    }
+    if (--stream->captured > 0) return true;
+
+    bool more;
+    if (stream->depth == 0 && stream->query.path->count == 0) {
+        more = stream_root(stream, stream->capture, at + 1 - stream->capture);
+    } else {
+        more = stream_deliver(stream, stream->capture, at + 1 - stream->capture,
+                              stream->capture_states, &stream->capture_child);
+    }
+
+    free(stream->capture_key);
+    stream->capture_key = NULL;
+    return more;
+}
+
+static bool
+stream_key(void *context, const uint8_t *text, size_t length)
+{
+    struct path_stream *stream = context;
+    if (stream->captured) return true;
+
+    free(stream->decoded);
+    stream->key = json_read_text(text, length, &stream->key_length,
+                                 &stream->decoded);
+    return stream->key != NULL;
+}
+
+static bool
+stream_scalar(void *context, const uint8_t *text, size_t length)
+{
+    struct path_stream *stream = context;
+    if (stream->captured) return true;
+
+    struct path_child child = { 0 };
+    bool capture;
+    uint64_t parent = stream->depth ? stream->frames[stream->depth].states : 1;
+    stream_value(stream, &child, &capture);
+    stream_count(stream);
+
+    if (!capture) return true;
+
+    if (stream->depth == 0 && stream->query.path->count == 0)
+        return stream_root(stream, text, length);
+    return stream_deliver(stream, text, length, parent, &child);
+}
+
+static const struct json_events stream_events = {
+    .begin  = stream_begin,
+    .end    = stream_end,
+    .key    = stream_key,
+    .scalar = stream_scalar,
+};
+
+size_t
+json_path_stream(const uint8_t *buffer, size_t length,
+                 const struct json_path *path,
+                 bool (*visit)(void *context, const struct json *value),
+                 void *context, enum json_status *status)
+{
+    if (!path || path->needs_length) {
+        *status = JSON_INVALID_PATH;
+        return 0;
+    }
+
+    struct path_stream *stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        *status = JSON_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    stream->query.path = path;
+    stream->query.visit = visit;
+    stream->query.context = context;
+
+    struct json_reader reader;
+    json_reader_init(&reader, buffer, length);
+
+    /*
+     * The walk stops without an error in the text only when the query is
+     * stopped or memory runs out.
+     */
+    bool walked = json_reader_walk(&reader, &stream_events, stream);
+
+    if (stream->query.stopped)
+        *status = JSON_SUCCESS;
+    else if (reader.status != JSON_SUCCESS)
+        *status = reader.status;
+    else if (!walked)
+        *status = JSON_OUT_OF_MEMORY;
+    else if (json_reader_next(&reader) != JSON_TOKEN_END)
+        *status = (reader.status != JSON_SUCCESS) ? reader.status
+                                                  : JSON_UNEXPECTED_CHARACTER;
+    else
+        *status = JSON_SUCCESS;
+
+    size_t matches = stream->query.matches;
+    free(stream->decoded);
+    free(stream->capture_key);
+    free(stream);
+    return matches;
+}
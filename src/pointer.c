@@ -0,0 +1,149 @@
+/**
+ * JSON Pointer (RFC 6901).
+ *
+ * A pointer such as `/a/b/0` is compiled once into its reference tokens, with
+ * `~1` and `~0` decoded to `/` and `~`.  Each token also records the hash of
+ * the key it names and the array index it denotes, if any, so evaluating a
+ * compiled pointer is one index probe or array access per token, without
+ * looking at the pointer text again.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t *
+pointer_token(const uint8_t *start, size_t length, size_t *decoded)
+{
+    uint8_t *token = malloc(length + 1);
+    if (!token) return NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (start[i] != '~') {
+            token[n++] = start[i];
+        }
+        else if (i + 1 < length && (start[i + 1] == '0' || start[i + 1] == '1')) {
+            token[n++] = (start[++i] == '0') ? '~' : '/';
+        }
+        else {
+            free(token);
+            return NULL;
+        }
+    }
+
+    token[n] = '\0';
+    *decoded = n;
+    return token;
+}
+
+/**
+ * Array indexes are written without leading zeros, and `-`, which names the
+ * position after the last element, never refers to an existing value.
+ */
+
+static size_t
+pointer_index(const uint8_t *token, size_t length)
+{
+    if (length == 0 || length > 19) return JSON_POINTER_NO_INDEX;
+    if (token[0] == '0' && length > 1) return JSON_POINTER_NO_INDEX;
+
+    size_t index = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (token[i] < '0' || token[i] > '9') return JSON_POINTER_NO_INDEX;
+        index = index * 10 + (token[i] - '0');
+    }
+    return index;
+}
+
+struct json_pointer *
+json_pointer_compile(const uint8_t *text)
+{
+    if (!text || (*text != '\0' && *text != '/')) return NULL;
+
+    size_t count = 0;
+    for (const uint8_t *p = text; *p; p++)
+        if (*p == '/') count++;
+
+    struct json_pointer *result =
+        calloc(1, sizeof(*result) + count * sizeof(*result->tokens));
+    if (!result) return NULL;
+
+    const uint8_t *start = text + 1;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *end = (const uint8_t *)strchr((const char *)start, '/');
+        if (!end) end = start + strlen((const char *)start);
+
+        struct json_pointer_token *token = &result->tokens[i];
+        token->key = pointer_token(start, end - start, &token->length);
+        if (!token->key) {
+            json_pointer_free(result);
+            return NULL;
+        }
+
+        token->hash = json_hash_bytes(token->key, token->length);
+        token->index = pointer_index(token->key, token->length);
+        result->count++;
+        start = end + 1;
+    }
+    return result;
+}
+
+void
+json_pointer_free(struct json_pointer *pointer)
+{
+    if (!pointer) return;
+
+    for (size_t i = 0; i < pointer->count; i++)
+        free(pointer->tokens[i].key);
+    free(pointer);
+}
+
+static struct json *
+pointer_walk(const struct json *json, const struct json_pointer *pointer,
+             size_t count, bool writable)
+{
+    if (!json || !pointer) return NULL;
+
+    struct json *value = (struct json *)json;
+
+    for (size_t i = 0; i < count && value; i++) {
+        const struct json_pointer_token *token = &pointer->tokens[i];
+
+        if (!json_resolve(value)) return NULL;
+
+        switch (json_kind(value)) {
+            case JSON_TYPE_OBJECT: {
+                struct json_member *member =
+                    json_object_find(value->data.object, token->key, token->hash);
+                value = member ? member->value : NULL;
+                break;
+            }
+            case JSON_TYPE_ARRAY:
+                if (token->index == JSON_POINTER_NO_INDEX)
+                    value = NULL;
+                else if (writable)
+                    value = json_get_array_item(value, token->index);
+                else
+                    value = json_array_get(value, token->index);
+                break;
+            default:
+                return NULL;
+        }
+    }
+    return value;
+}
+
+struct json *
+json_pointer_walk(const struct json *json, const struct json_pointer *pointer,
+                  size_t count)
+{
+    return pointer_walk(json, pointer, count, true);
+}
+
+struct json *
+json_pointer_get(const struct json *json, const struct json_pointer *pointer)
+{
+    return pointer ? pointer_walk(json, pointer, pointer->count, false) : NULL;
+}
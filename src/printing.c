@@ -9,6 +9,10 @@
 #include "internal.h"
 #include "ustring.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 /**
  * If the object or array includes at least one object or another array, it
  * should be printed with indentation for better readability.
@@ -17,10 +21,12 @@
 static bool
 object_contains_object_or_array(const struct json_object *object)
 {
+    if (!object) return false;
+
     struct json_member *member = object->members;
     while (member) {
-        if (member->value->type == JSON_TYPE_OBJECT ||
-            member->value->type == JSON_TYPE_ARRAY) {
+        if (json_kind(member->value) == JSON_TYPE_OBJECT ||
+            json_kind(member->value) == JSON_TYPE_ARRAY) {
             return true;
         }
         member = member->next;
@@ -31,9 +37,11 @@ object_contains_object_or_array(const struct json_object *object)
 static bool
 array_contains_object_or_array(const struct json_array *array)
 {
+    if (!array) return false;
+
     for (size_t i = 0; i < array->count; i++) {
-        if (array->items[i]->type == JSON_TYPE_OBJECT ||
-            array->items[i]->type == JSON_TYPE_ARRAY) {
+        if (json_kind(array->items[i]) == JSON_TYPE_OBJECT ||
+            json_kind(array->items[i]) == JSON_TYPE_ARRAY) {
             return true;
         }
     }
@@ -138,7 +146,8 @@ json_print_string(const uint8_t *text, FILE *out, bool ascii)
  * primitive values in standard syntax.
  */
 
-static void json_print_indent(const struct json *json, FILE *out, int indent);
+static bool json_print_indent(const struct json *json, FILE *out, int indent,
+                              bool sorted);
 
 static void
 print_indent(FILE *out, int indent)
@@ -148,69 +157,102 @@ print_indent(FILE *out, int indent)
     }
 }
 
-static void
-print_object(const struct json_object *object, FILE *out, int indent)
+/**
+ * With `sorted`, members are written in the order of the object's sorted
+ * view instead of the order they were added in.
+ */
+
+static bool
+print_object(struct json_object *object, FILE *out, int indent, bool sorted)
 {
     bool multi = object_contains_object_or_array(object);
+    size_t count = object ? object->count : 0;
+
+    struct json_member **members = (sorted && count) ? json_object_sorted(object) : NULL;
+    if (sorted && count && !members) return false;
 
     fprintf(out, multi ? "{\n" : "{");
 
-    struct json_member *member = object->members;
-    for (; member; member = member->next)
+    struct json_member *link = object ? object->members : NULL;
+    bool printed = true;
+    for (size_t i = 0; i < count && printed; i++, link = link->next)
     {
+        const struct json_member *member = members ? members[i] : link;
+
         if (multi) print_indent(out, indent + 2);
         json_print_string(member->key, out, false);
         fprintf(out, ": ");
         
-        json_print_indent(member->value, out, indent + 2);
+        printed = json_print_indent(member->value, out, indent + 2, sorted);
 
-        if (member->next) fprintf(out, ", ");
+        if (i < count - 1) fprintf(out, ", ");
         if (multi) fprintf(out, "\n");
     }
 
     if (multi) print_indent(out, indent);
     fprintf(out, "}");
+    return printed;
 }
 
-static void
-print_array(const struct json_array *array, FILE *out, int indent)
+static bool
+print_array(const struct json_array *array, FILE *out, int indent, bool sorted)
 {
     bool multiline = array_contains_object_or_array(array);
 
     fprintf(out, multiline ? "[\n" : "[");
 
-    for (size_t i = 0; i < array->count; i++) {
+    size_t count = array ? array->count : 0;
+    bool printed = true;
+    for (size_t i = 0; i < count && printed; i++) {
         if (multiline) print_indent(out, indent + 2);
         
-        json_print_indent(array->items[i], out, indent + 2);
+        printed = json_print_indent(array->items[i], out, indent + 2, sorted);
 
-        if (i < array->count - 1) fprintf(out, ", ");
+        if (i < count - 1) fprintf(out, ", ");
         if (multiline) fprintf(out, "\n");
     }
 
     if (multiline) print_indent(out, indent);
     fprintf(out, "]");
+    return printed;
+}
+
+static void
+print_numbers(const struct json_numbers *numbers, FILE *out)
+{
+    fprintf(out, "[");
+
+    for (size_t i = 0; i < numbers->count; i++) {
+        fprintf(out, "%f", numbers->values[i]);
+        if (i < numbers->count - 1) fprintf(out, ", ");
+    }
+
+    fprintf(out, "]");
 }
 
 /**
  * Dispatches to the appropriate print function for objects, arrays, strings,
- * numbers, booleans, and null values.
+ * numbers, booleans, and null values.  Nothing is printed for NULL; a
+ * pending value that cannot be expanded fails like any allocation.
  */
 
-static void
-json_print_indent(const struct json *json, FILE *out, int indent)
+static bool
+json_print_indent(const struct json *json, FILE *out, int indent, bool sorted)
 {
-    if (!json) return;
+    if (!json) return true;
+    if (!json_resolve(json)) return false;
 
-    switch (json->type) {
+    switch (json_kind(json)) {
         case JSON_TYPE_OBJECT:
-            print_object(&json->data.object, out, indent);
-            break;
+            return print_object(json->data.object, out, indent, sorted);
         case JSON_TYPE_ARRAY:
-            print_array(&json->data.array, out, indent);
+            if (json->tag & JSON_TAG_PACKED)
+                print_numbers(json->data.numbers, out);
+            else
+                return print_array(json->data.array, out, indent, sorted);
             break;
         case JSON_TYPE_STRING:
-            json_print_string(json->data.string, out, false);
+            json_print_string(json_string(json), out, false);
             break;
         case JSON_TYPE_NUMBER:
             fprintf(out, "%f", json->data.number);
@@ -222,11 +264,270 @@ json_print_indent(const struct json *json, FILE *out, int indent)
             fprintf(out, "null");
             break;
     }
+    return true;
 }
 
 void
 json_print(const struct json *json, FILE *out)
 {
     int ident = 0;
-    json_print_indent(json, out, ident);
+    json_print_indent(json, out, ident, false);
+}
+
+bool
+json_print_sorted(const struct json *json, FILE *out)
+{
+    return json_print_indent(json, out, 0, true);
+}
+
+/**
+ * Canonical output (RFC 8785).
+ *
+ * Members are sorted by their keys compared as UTF-16 code units, numbers
+ * take the shortest form that reads back as the same double, written as
+ * ECMAScript does, and strings escape only what JSON requires.  There is no
+ * whitespace, so equal values always produce the same bytes.
+ */
+
+struct utf16_units {
+    const uint8_t *p;
+    const uint8_t *end;
+    int pending;
+};
+
+static int
+next_utf16_unit(struct utf16_units *units)
+{
+    if (units->pending >= 0) {
+        int unit = units->pending;
+        units->pending = -1;
+        return unit;
+    }
+    if (units->p >= units->end) return -1;
+
+    uint32_t code;
+    if (!decode_next_UTF8(&units->p, units->end, &code)) {
+        units->p++;
+        code = 0xFFFD;
+    }
+
+    if (code >= 0x10000) {
+        uint32_t v = code - 0x10000;
+        units->pending = 0xDC00 + (v & 0x3FF);
+        return 0xD800 + (v >> 10);
+    }
+    return (int)code;
+}
+
+static int
+compare_members(const void *a, const void *b)
+{
+    const struct json_member *x = *(const struct json_member *const *)a;
+    const struct json_member *y = *(const struct json_member *const *)b;
+
+    struct utf16_units p = { x->key, x->key + x->length, -1 };
+    struct utf16_units q = { y->key, y->key + y->length, -1 };
+
+    for (;;) {
+        int u = next_utf16_unit(&p);
+        int v = next_utf16_unit(&q);
+        if (u != v || u < 0) return u - v;
+    }
+}
+
+/**
+ * Returns the members of a non-empty object sorted by key, or NULL if memory
+ * runs out.  The view is kept in the object until a member is added or
+ * removed.  A frozen object may be printed from several threads at once, so
+ * the view is published with a compare-and-swap, and a thread that loses the
+ * race frees its own copy and uses the winner's.
+ */
+
+struct json_member **
+json_object_sorted(struct json_object *object)
+{
+    struct json_member **sorted = __atomic_load_n(&object->sorted, __ATOMIC_ACQUIRE);
+    if (sorted) return sorted;
+
+    sorted = malloc(object->count * sizeof(*sorted));
+    if (!sorted) return NULL;
+
+    size_t n = 0;
+    for (struct json_member *member = object->members; member; member = member->next)
+        sorted[n++] = member;
+    qsort(sorted, n, sizeof(*sorted), compare_members);
+
+    struct json_member **expected = NULL;
+    if (!__atomic_compare_exchange_n(&object->sorted, &expected, sorted, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(sorted);
+        sorted = expected;
+    }
+    return sorted;
+}
+
+static void
+print_canonical_string(const uint8_t *text, FILE *out)
+{
+    fputc('"', out);
+
+    const uint8_t *end = text + strlen((const char *)text);
+    for (const uint8_t *p = text; p < end; ) {
+        const uint8_t *start = p;
+        uint32_t code;
+
+        if (!decode_next_UTF8(&p, end, &code)) {
+            json_print_question_mark(out, false);
+            p = start + 1;
+            while (p < end && (*p & 0xC0) == 0x80 && p - start < 4) p++;
+            continue;
+        }
+
+        switch (code) {
+        case '\"': fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\b': fputs("\\b",  out); break;
+        case '\f': fputs("\\f",  out); break;
+        case '\n': fputs("\\n",  out); break;
+        case '\r': fputs("\\r",  out); break;
+        case '\t': fputs("\\t",  out); break;
+        default:
+            if (code < 0x20)
+                fprintf(out, "\\u%04x", code);
+            else
+                fwrite(start, 1, p - start, out);
+            break;
+        }
+    }
+
+    fputc('"', out);
+}
+
+/**
+ * Finds the fewest significant digits that convert back to the same double,
+ * then places the decimal point as Number.prototype.toString does: plain
+ * notation for decimal exponents from -6 to 20, exponential otherwise.
+ */
+
+static bool
+print_canonical_number(double number, FILE *out)
+{
+    if (!isfinite(number)) return false;
+    if (number == 0) {
+        fputc('0', out);
+        return true;
+    }
+
+    char buffer[32];
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, number);
+        if (strtod(buffer, NULL) == number) break;
+    }
+
+    const char *p = buffer;
+    if (*p == '-') fputc(*p++, out);
+
+    char digits[24];
+    int k = 0;
+    for (; *p != 'e'; p++) {
+        if (*p != '.') digits[k++] = *p;
+    }
+    while (k > 1 && digits[k - 1] == '0') k--;
+
+    int n = atoi(p + 1) + 1;
+
+    if (k <= n && n <= 21) {
+        fwrite(digits, 1, k, out);
+        for (int i = k; i < n; i++) fputc('0', out);
+    }
+    else if (0 < n && n <= 21) {
+        fwrite(digits, 1, n, out);
+        fputc('.', out);
+        fwrite(digits + n, 1, k - n, out);
+    }
+    else if (-6 < n && n <= 0) {
+        fputs("0.", out);
+        for (int i = n; i < 0; i++) fputc('0', out);
+        fwrite(digits, 1, k, out);
+    }
+    else {
+        fputc(digits[0], out);
+        if (k > 1) {
+            fputc('.', out);
+            fwrite(digits + 1, 1, k - 1, out);
+        }
+        fprintf(out, "e%c%d", (n - 1 < 0) ? '-' : '+', abs(n - 1));
+    }
+    return true;
+}
+
+static bool print_canonical(const struct json *json, FILE *out);
+
+static bool
+print_canonical_object(struct json_object *object, FILE *out)
+{
+    size_t count = object ? object->count : 0;
+    if (count == 0) {
+        fputs("{}", out);
+        return true;
+    }
+
+    struct json_member **members = json_object_sorted(object);
+    if (!members) return false;
+
+    bool printed = true;
+    fputc('{', out);
+    for (size_t i = 0; i < count && printed; i++) {
+        if (i > 0) fputc(',', out);
+        print_canonical_string(members[i]->key, out);
+        fputc(':', out);
+        printed = print_canonical(members[i]->value, out);
+    }
+    fputc('}', out);
+    return printed;
+}
+
+static bool
+print_canonical(const struct json *json, FILE *out)
+{
+    if (!json || !json_resolve(json)) return false;
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT:
+            return print_canonical_object(json->data.object, out);
+        case JSON_TYPE_ARRAY: {
+            bool packed = (json->tag & JSON_TAG_PACKED);
+            size_t count = packed ? json->data.numbers->count
+                         : json->data.array ? json->data.array->count : 0;
+            bool printed = true;
+
+            fputc('[', out);
+            for (size_t i = 0; i < count && printed; i++) {
+                if (i > 0) fputc(',', out);
+                printed = packed
+                        ? print_canonical_number(json->data.numbers->values[i], out)
+                        : print_canonical(json->data.array->items[i], out);
+            }
+            fputc(']', out);
+            return printed;
+        }
+        case JSON_TYPE_STRING:
+            print_canonical_string(json_string(json), out);
+            return true;
+        case JSON_TYPE_NUMBER:
+            return print_canonical_number(json->data.number, out);
+        case JSON_TYPE_BOOLEAN:
+            fputs(json->data.boolean ? "true" : "false", out);
+            return true;
+        case JSON_TYPE_NULL:
+            fputs("null", out);
+            return true;
+    }
+    return false;
+}
+
+bool
+json_print_canonical(const struct json *json, FILE *out)
+{
+    return print_canonical(json, out);
 }
@@ -0,0 +1,216 @@
+/**
+ * Field projection while parsing.
+ *
+ * A projection is a keep-list of paths in JSON Pointer syntax, compiled by
+ * json_pointer_compile, where a `*` segment matches any key or index.  While
+ * the grammar parses with a projection active, it asks this module before
+ * each value whether the value lies on or under a kept path.  Values that do not are never built: the
+ * lexer scans over them by matching brackets, without decoding strings or
+ * converting numbers, and hands the parser a single SKIPPED token.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PROJECTION_MAX_PATHS 64
+
+/**
+ * Parse state for one open container.
+ *
+ * `mask` holds the paths whose leading segments match the location of the
+ * container, and `all` is set once a path has matched completely, so that
+ * the whole subtree is kept.  `index` counts the elements of arrays.
+ */
+
+struct projection_frame {
+    uint64_t mask;
+    bool all;
+    size_t depth;
+    size_t index;
+};
+
+struct json_projection {
+    struct json_pointer *paths[PROJECTION_MAX_PATHS];
+    size_t count;
+
+    struct projection_frame *frames;
+    size_t depth;
+    size_t capacity;
+
+    struct projection_frame next;
+};
+
+struct json_projection *json_projection = NULL;
+int json_skip_value = 0;
+
+struct json_projection *
+json_projection_new(const uint8_t *const *paths, size_t count)
+{
+    if (count > PROJECTION_MAX_PATHS) return NULL;
+
+    struct json_projection *result = calloc(1, sizeof(*result));
+    if (!result) return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        result->paths[i] = json_pointer_compile(paths[i]);
+        if (!result->paths[i]) {
+            json_projection_free(result);
+            return NULL;
+        }
+        result->count++;
+    }
+    return result;
+}
+
+void
+json_projection_free(struct json_projection *projection)
+{
+    if (!projection) return;
+
+    for (size_t i = 0; i < projection->count; i++)
+        json_pointer_free(projection->paths[i]);
+
+    free(projection->frames);
+    free(projection);
+}
+
+/**
+ * Decisions made by the grammar actions.
+ *
+ * Before each value, the grammar reports its key or array position.  The
+ * decision for the value is kept in `next` until the value turns out to be a
+ * container, in which case it becomes the frame for that container.  A value
+ * that matches no path sets json_skip_value, which the lexer reads before
+ * scanning the first token of the value.
+ */
+
+static void
+project_decide(struct json_projection *projection, const uint8_t *key,
+               size_t index)
+{
+    const struct projection_frame *parent =
+        &projection->frames[projection->depth - 1];
+
+    struct projection_frame *next = &projection->next;
+    next->mask = 0;
+    next->all = parent->all;
+    next->depth = parent->depth + 1;
+    next->index = 0;
+
+    if (!next->all) {
+        char number[24];
+        if (!key) {
+            snprintf(number, sizeof(number), "%zu", index);
+            key = (const uint8_t *)number;
+        }
+
+        for (size_t i = 0; i < projection->count; i++) {
+            if (!(parent->mask & ((uint64_t)1 << i))) continue;
+
+            const struct json_pointer *path = projection->paths[i];
+            const uint8_t *segment = path->tokens[parent->depth].key;
+            if (strcmp((const char *)segment, "*") != 0
+             && strcmp((const char *)segment, (const char *)key) != 0)
+                continue;
+
+            if (path->count == next->depth)
+                next->all = true;
+            else
+                next->mask |= (uint64_t)1 << i;
+        }
+    }
+
+    json_skip_value = !next->all && !next->mask;
+}
+
+void
+json_project_root(void)
+{
+    struct json_projection *projection = json_projection;
+    json_skip_value = 0;
+    if (!projection) return;
+
+    projection->depth = 0;
+    projection->next.mask = 0;
+    projection->next.all = false;
+    projection->next.depth = 0;
+    projection->next.index = 0;
+
+    for (size_t i = 0; i < projection->count; i++) {
+        if (projection->paths[i]->count == 0)
+            projection->next.all = true;
+        else
+            projection->next.mask |= (uint64_t)1 << i;
+    }
+}
+
+void
+json_project_key(const uint8_t *key)
+{
+    if (json_projection)
+        project_decide(json_projection, key, 0);
+}
+
+void
+json_project_element(void)
+{
+    struct json_projection *projection = json_projection;
+    if (!projection) return;
+
+    struct projection_frame *parent = &projection->frames[projection->depth - 1];
+    project_decide(projection, NULL, parent->index++);
+}
+
+bool
+json_project_enter(void)
+{
+    struct json_projection *projection = json_projection;
+    if (!projection) return true;
+
+    if (projection->depth == projection->capacity) {
+        size_t request = projection->capacity ? projection->capacity * 2 : 16;
+        void *resized = realloc(projection->frames,
+                                request * sizeof(*projection->frames));
+        if (!resized) return false;
+
+        projection->frames = resized;
+        projection->capacity = request;
+    }
+
+    projection->frames[projection->depth++] = projection->next;
+    return true;
+}
+
+void
+json_project_leave(void)
+{
+    if (json_projection && json_projection->depth > 0)
+        json_projection->depth--;
+}
+
+/**
+ * Parses the input stream keeping only the values on or under the given
+ * paths.  Containers on the way to a kept path are created with only the
+ * members and elements that lead to it.
+ */
+
+struct json *
+json_parse_projected(FILE *in, const uint8_t *const *paths, size_t count,
+                     enum json_status *status)
+{
+    struct json_projection *projection = json_projection_new(paths, count);
+    if (!projection) {
+        *status = JSON_INVALID_PATH;
+        return NULL;
+    }
+
+    json_projection = projection;
+    struct json *result = json_parse(in, status);
+    json_projection = NULL;
+    json_skip_value = 0;
+
+    json_projection_free(projection);
+    return result;
+}
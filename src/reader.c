@@ -0,0 +1,663 @@
+/**
+ * Tokenizer and structural walker for JSON text held in memory.
+ *
+ * The generated lexer and parser read from a stream and build a complete
+ * value tree.  The reader in this file works directly on a byte buffer
+ * instead: it recognizes the same tokens as the lexer, validates each lexeme
+ * in place, and reports the structure of the document through callbacks
+ * without allocating.  Higher-level features decide what, if anything, to
+ * build from those events.
+ */
+
+#include "internal.h"
+#include "ustring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Bytes that may appear unescaped inside a string without further checks:
+ * printable ASCII other than the quote and the backslash.
+ */
+
+static const bool plain_char[256] = {
+    [0x20] = 1, [0x21] = 1,
+    [0x23] = 1, [0x24] = 1, [0x25] = 1, [0x26] = 1, [0x27] = 1,
+    [0x28] = 1, [0x29] = 1, [0x2A] = 1, [0x2B] = 1, [0x2C] = 1,
+    [0x2D] = 1, [0x2E] = 1, [0x2F] = 1, [0x30] = 1, [0x31] = 1,
+    [0x32] = 1, [0x33] = 1, [0x34] = 1, [0x35] = 1, [0x36] = 1,
+    [0x37] = 1, [0x38] = 1, [0x39] = 1, [0x3A] = 1, [0x3B] = 1,
+    [0x3C] = 1, [0x3D] = 1, [0x3E] = 1, [0x3F] = 1, [0x40] = 1,
+    [0x41] = 1, [0x42] = 1, [0x43] = 1, [0x44] = 1, [0x45] = 1,
+    [0x46] = 1, [0x47] = 1, [0x48] = 1, [0x49] = 1, [0x4A] = 1,
+    [0x4B] = 1, [0x4C] = 1, [0x4D] = 1, [0x4E] = 1, [0x4F] = 1,
+    [0x50] = 1, [0x51] = 1, [0x52] = 1, [0x53] = 1, [0x54] = 1,
+    [0x55] = 1, [0x56] = 1, [0x57] = 1, [0x58] = 1, [0x59] = 1,
+    [0x5A] = 1, [0x5B] = 1,
+    [0x5D] = 1, [0x5E] = 1, [0x5F] = 1, [0x60] = 1, [0x61] = 1,
+    [0x62] = 1, [0x63] = 1, [0x64] = 1, [0x65] = 1, [0x66] = 1,
+    [0x67] = 1, [0x68] = 1, [0x69] = 1, [0x6A] = 1, [0x6B] = 1,
+    [0x6C] = 1, [0x6D] = 1, [0x6E] = 1, [0x6F] = 1, [0x70] = 1,
+    [0x71] = 1, [0x72] = 1, [0x73] = 1, [0x74] = 1, [0x75] = 1,
+    [0x76] = 1, [0x77] = 1, [0x78] = 1, [0x79] = 1, [0x7A] = 1,
+    [0x7B] = 1, [0x7C] = 1, [0x7D] = 1, [0x7E] = 1, [0x7F] = 1,
+};
+
+/**
+ * Tests eight string bytes at once.  The word is plain if no byte is a quote,
+ * a backslash, a control character, or part of a multi-byte sequence; a false
+ * result only means the bytes must be examined one at a time.
+ */
+
+static bool
+plain_word(uint64_t word)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t high = 0x8080808080808080ULL;
+
+    uint64_t quote = word ^ (ones * '"');
+    uint64_t slash = word ^ (ones * '\\');
+    uint64_t special = ((quote - ones) & ~quote)
+                     | ((slash - ones) & ~slash)
+                     | (word - ones * 0x20)
+                     | word;
+    return (special & high) == 0;
+}
+
+static bool
+is_digit(uint8_t c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static int
+hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void
+json_reader_init(struct json_reader *reader, const uint8_t *text, size_t length)
+{
+    reader->start = text;
+    reader->end = text + length;
+    reader->cursor = text;
+    reader->token = text;
+    reader->length = 0;
+    reader->status = JSON_SUCCESS;
+}
+
+static enum json_token
+reader_fail(struct json_reader *reader, const uint8_t *at,
+            enum json_status status)
+{
+    reader->cursor = at;
+    reader->status = status;
+    return JSON_TOKEN_ERROR;
+}
+
+/**
+ * Reads the four hex digits of a `\uXXXX` escape at `p` and returns the code
+ * unit, or -1 if the digits are missing or malformed.
+ */
+
+static int
+read_escape_unit(const uint8_t *p, const uint8_t *end)
+{
+    if (end - p < 4) return -1;
+
+    int code = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(p[i]);
+        if (digit < 0) return -1;
+        code = (code << 4) | digit;
+    }
+    return code;
+}
+
+/**
+ * Scans a string literal starting at the opening quote.  Escapes must match
+ * those accepted by json_unescape_string and raw bytes must form valid UTF-8,
+ * so a string accepted here can always be decoded later.
+ */
+
+static enum json_token
+read_string(struct json_reader *reader)
+{
+    const uint8_t *p = reader->token + 1;
+    const uint8_t *end = reader->end;
+
+    for (;;) {
+        while (end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            if (!plain_word(word)) break;
+            p += 8;
+        }
+        while (p < end && plain_char[*p]) p++;
+
+        if (p >= end)
+            return reader_fail(reader, p, JSON_UNEXPECTED_FILE_END);
+
+        uint8_t c = *p;
+        if (c == '"') {
+            p++;
+            break;
+        }
+        else if (c == '\\') {
+            if (end - p < 2)
+                return reader_fail(reader, end, JSON_UNEXPECTED_FILE_END);
+
+            switch (p[1]) {
+            case '"': case '\\': case '/':
+            case 'b': case 'f': case 'n': case 'r': case 't':
+                p += 2;
+                break;
+            case 'u': {
+                int code = read_escape_unit(p + 2, end);
+                if (code < 0)
+                    return reader_fail(reader, p, JSON_INVALID_UNICODE);
+                if (code >= 0xDC00 && code <= 0xDFFF)
+                    return reader_fail(reader, p, JSON_INVALID_UNICODE);
+                p += 6;
+
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return reader_fail(reader, p, JSON_INVALID_UNICODE);
+
+                    int pair = read_escape_unit(p + 2, end);
+                    if (pair < 0xDC00 || pair > 0xDFFF)
+                        return reader_fail(reader, p, JSON_INVALID_UNICODE);
+                    p += 6;
+                }
+                break;
+            }
+            default:
+                return reader_fail(reader, p, JSON_INVALID_ESCAPE);
+            }
+        }
+        else if (c < 0x20) {
+            return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+        }
+        else {
+            uint32_t code;
+            if (!decode_next_UTF8(&p, end, &code))
+                return reader_fail(reader, p, JSON_INVALID_UNICODE);
+        }
+    }
+
+    reader->cursor = p;
+    reader->length = p - reader->token;
+    return JSON_TOKEN_STRING;
+}
+
+/**
+ * Scans a number using the ECMA-404 grammar also used by the lexer:
+ * an optional minus, an integer without leading zeros, an optional fraction,
+ * and an optional exponent.
+ */
+
+static enum json_token
+read_number(struct json_reader *reader)
+{
+    const uint8_t *p = reader->token;
+    const uint8_t *end = reader->end;
+
+    if (p < end && *p == '-') p++;
+
+    if (p >= end)
+        return reader_fail(reader, p, JSON_UNEXPECTED_FILE_END);
+    if (*p == '0')
+        p++;
+    else if (is_digit(*p))
+        while (p < end && is_digit(*p)) p++;
+    else
+        return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || !is_digit(*p))
+            return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+        while (p < end && is_digit(*p)) p++;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p >= end || !is_digit(*p))
+            return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+        while (p < end && is_digit(*p)) p++;
+    }
+
+    reader->cursor = p;
+    reader->length = p - reader->token;
+    return JSON_TOKEN_NUMBER;
+}
+
+static enum json_token
+read_literal(struct json_reader *reader, const char *word, enum json_token token)
+{
+    size_t length = strlen(word);
+    const uint8_t *p = reader->token;
+
+    if ((size_t)(reader->end - p) < length) {
+        if (memcmp(p, word, reader->end - p) == 0)
+            return reader_fail(reader, reader->end, JSON_UNEXPECTED_FILE_END);
+        return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+    }
+    if (memcmp(p, word, length) != 0)
+        return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+
+    reader->cursor = p + length;
+    reader->length = length;
+    return token;
+}
+
+enum json_token
+json_reader_next(struct json_reader *reader)
+{
+    const uint8_t *p = reader->cursor;
+    const uint8_t *end = reader->end;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    reader->token = p;
+    reader->length = 1;
+
+    if (p >= end) {
+        reader->cursor = p;
+        reader->length = 0;
+        return JSON_TOKEN_END;
+    }
+
+    reader->cursor = p + 1;
+
+    switch (*p) {
+    case '{': return JSON_TOKEN_BEGIN_OBJECT;
+    case '}': return JSON_TOKEN_END_OBJECT;
+    case '[': return JSON_TOKEN_BEGIN_ARRAY;
+    case ']': return JSON_TOKEN_END_ARRAY;
+    case ':': return JSON_TOKEN_COLON;
+    case ',': return JSON_TOKEN_COMMA;
+    case '"': return read_string(reader);
+    case 't': return read_literal(reader, "true", JSON_TOKEN_TRUE);
+    case 'f': return read_literal(reader, "false", JSON_TOKEN_FALSE);
+    case 'n': return read_literal(reader, "null", JSON_TOKEN_NULL);
+    default:
+        if (*p == '-' || is_digit(*p))
+            return read_number(reader);
+        return reader_fail(reader, p, JSON_UNEXPECTED_CHARACTER);
+    }
+}
+
+/**
+ * Structural walk of a single value.
+ *
+ * The walk is iterative; the kind of each open container is kept in a bit
+ * stack so that nesting costs no allocation.  The walk stops after the first
+ * complete value, leaving the reader positioned just past it.
+ */
+
+static void
+stack_set(uint64_t *stack, size_t depth, bool object)
+{
+    uint64_t bit = (uint64_t)1 << (depth % 64);
+    if (object)
+        stack[depth / 64] |= bit;
+    else
+        stack[depth / 64] &= ~bit;
+}
+
+static bool
+stack_get(const uint64_t *stack, size_t depth)
+{
+    return (stack[depth / 64] >> (depth % 64)) & 1;
+}
+
+static bool
+walk_fail(struct json_reader *reader, enum json_token token)
+{
+    if (token == JSON_TOKEN_ERROR) return false;
+
+    reader->cursor = reader->token;
+    reader->status = (token == JSON_TOKEN_END) ? JSON_UNEXPECTED_FILE_END
+                                               : JSON_UNEXPECTED_CHARACTER;
+    return false;
+}
+
+bool
+json_reader_walk(struct json_reader *reader, const struct json_events *events,
+                 void *context)
+{
+    uint64_t stack[JSON_MAX_DEPTH / 64];
+    size_t depth = 0;
+
+    enum json_token token = json_reader_next(reader);
+
+    for (;;) {
+        const uint8_t *text = reader->token;
+        size_t length = reader->length;
+
+        /* A value is expected: open a container or report a scalar. */
+        switch (token) {
+        case JSON_TOKEN_BEGIN_OBJECT:
+        case JSON_TOKEN_BEGIN_ARRAY: {
+            bool object = (token == JSON_TOKEN_BEGIN_OBJECT);
+            if (depth == JSON_MAX_DEPTH) {
+                reader->cursor = text;
+                reader->status = JSON_NESTING_TOO_DEEP;
+                return false;
+            }
+            if (events->begin && !events->begin(context, text))
+                return false;
+
+            stack_set(stack, depth++, object);
+            token = json_reader_next(reader);
+
+            if (token == (object ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY)) {
+                depth--;
+                if (events->end && !events->end(context, reader->token))
+                    return false;
+                break;
+            }
+            if (!object)
+                continue;
+
+            if (token != JSON_TOKEN_STRING)
+                return walk_fail(reader, token);
+            if (events->key && !events->key(context, reader->token, reader->length))
+                return false;
+            if ((token = json_reader_next(reader)) != JSON_TOKEN_COLON)
+                return walk_fail(reader, token);
+
+            token = json_reader_next(reader);
+            continue;
+        }
+        case JSON_TOKEN_STRING:
+        case JSON_TOKEN_NUMBER:
+        case JSON_TOKEN_TRUE:
+        case JSON_TOKEN_FALSE:
+        case JSON_TOKEN_NULL:
+            if (events->scalar && !events->scalar(context, text, length))
+                return false;
+            break;
+        default:
+            return walk_fail(reader, token);
+        }
+
+        /* A value is complete: close containers until a comma or the end. */
+        for (;;) {
+            if (depth == 0)
+                return true;
+
+            bool object = stack_get(stack, depth - 1);
+            token = json_reader_next(reader);
+
+            if (token == (object ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY)) {
+                depth--;
+                if (events->end && !events->end(context, reader->token))
+                    return false;
+                continue;
+            }
+            if (token != JSON_TOKEN_COMMA)
+                return walk_fail(reader, token);
+
+            token = json_reader_next(reader);
+            if (object) {
+                if (token != JSON_TOKEN_STRING)
+                    return walk_fail(reader, token);
+                if (events->key && !events->key(context, reader->token, reader->length))
+                    return false;
+                if ((token = json_reader_next(reader)) != JSON_TOKEN_COLON)
+                    return walk_fail(reader, token);
+                token = json_reader_next(reader);
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Skipping the rest of a value.
+ *
+ * Once a caller has seen enough of a value, the remainder is passed over by
+ * matching brackets.  Only brackets and string boundaries are examined, so
+ * the skipped text is checked for nothing but balance.
+ */
+
+static const bool skip_char[256] = {
+    ['"'] = 1, ['['] = 1, [']'] = 1, ['{'] = 1, ['}'] = 1,
+};
+
+bool
+json_reader_skip(struct json_reader *reader, size_t depth)
+{
+    const uint8_t *p = reader->cursor;
+    const uint8_t *end = reader->end;
+
+    while (depth > 0) {
+        while (p < end && !skip_char[*p]) p++;
+        if (p >= end) break;
+
+        switch (*p++) {
+        case '[': case '{':
+            depth++;
+            break;
+        case ']': case '}':
+            depth--;
+            break;
+        default:
+            for (;;) {
+                while (end - p >= 8) {
+                    uint64_t word;
+                    memcpy(&word, p, sizeof(word));
+                    if (!plain_word(word)) break;
+                    p += 8;
+                }
+                while (p < end && *p != '"' && *p != '\\') p++;
+
+                if (p >= end) break;
+                if (*p++ == '"') break;
+                if (p++ >= end) break;
+            }
+            break;
+        }
+    }
+
+    if (depth > 0 || p > end) {
+        reader_fail(reader, end, JSON_UNEXPECTED_FILE_END);
+        return false;
+    }
+    reader->cursor = p;
+    return true;
+}
+
+/**
+ * Checks that a buffer holds exactly one well-formed JSON value.
+ *
+ * Runs the reader without callbacks, so nothing is allocated, no string is
+ * decoded, and no number is converted.  On failure, the offset of the first
+ * error is stored; on success, the offset is the length of the buffer.
+ */
+
+bool
+json_validate(const uint8_t *buffer, size_t length, enum json_status *status,
+              size_t *offset)
+{
+    static const struct json_events none = { 0 };
+
+    struct json_reader reader;
+    json_reader_init(&reader, buffer, length);
+
+    bool valid = json_reader_walk(&reader, &none, NULL);
+    if (valid && json_reader_next(&reader) != JSON_TOKEN_END) {
+        reader.cursor = reader.token;
+        reader.status = JSON_UNEXPECTED_CHARACTER;
+        valid = false;
+    }
+
+    if (status) *status = valid ? JSON_SUCCESS : reader.status;
+    if (offset) *offset = valid ? length : (size_t)(reader.cursor - buffer);
+    return valid;
+}
+
+/**
+ * Comparison operators.
+ */
+
+const uint8_t *
+json_skip_space(const uint8_t *text)
+{
+    while (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r') text++;
+    return text;
+}
+
+enum json_compare
+json_parse_compare(const uint8_t **cursor)
+{
+    static const struct { const char *text; enum json_compare compare; } ops[] = {
+        { "==", JSON_COMPARE_EQUAL },      { "!=", JSON_COMPARE_NOT_EQUAL },
+        { "<=", JSON_COMPARE_LESS_EQUAL }, { ">=", JSON_COMPARE_GREATER_EQUAL },
+        { "<",  JSON_COMPARE_LESS },       { ">",  JSON_COMPARE_GREATER },
+    };
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+        size_t length = strlen(ops[i].text);
+        if (strncmp((const char *)*cursor, ops[i].text, length) == 0) {
+            *cursor += length;
+            return ops[i].compare;
+        }
+    }
+    return JSON_COMPARE_NONE;
+}
+
+bool
+json_compare_order(enum json_compare compare, int order)
+{
+    switch (compare) {
+        case JSON_COMPARE_NONE:          return false;
+        case JSON_COMPARE_EQUAL:         return order == 0;
+        case JSON_COMPARE_NOT_EQUAL:     return order != 0;
+        case JSON_COMPARE_LESS:          return order < 0;
+        case JSON_COMPARE_LESS_EQUAL:    return order <= 0;
+        case JSON_COMPARE_GREATER:       return order > 0;
+        case JSON_COMPARE_GREATER_EQUAL: return order >= 0;
+    }
+    return false;
+}
+
+/**
+ * Conversion of validated lexemes into values.
+ */
+
+double
+json_read_number(const uint8_t *text, size_t length)
+{
+    double value;
+    if (json_number_exact(text, length, &value))
+        return value;
+
+    char local[64];
+    char *copy = (length < sizeof(local)) ? local : malloc(length + 1);
+    if (!copy) return 0;
+
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    value = strtod(copy, NULL);
+    if (copy != local) free(copy);
+    return value;
+}
+
+uint8_t *
+json_read_string(const uint8_t *text, size_t length)
+{
+    if (length < 2) return NULL;
+    return json_unescape_string(text + 1, length - 2, NULL);
+}
+
+const uint8_t *
+json_read_text(const uint8_t *text, size_t length, size_t *size,
+               uint8_t **decoded)
+{
+    *decoded = NULL;
+
+    if (!memchr(text + 1, '\\', length - 2)) {
+        *size = length - 2;
+        return text + 1;
+    }
+
+    *decoded = json_read_string(text, length);
+    if (!*decoded) return NULL;
+
+    *size = strlen((const char *)*decoded);
+    return *decoded;
+}
+
+/**
+ * Following fields through a record.
+ *
+ * A field reaches a value if the field of its container did and the next
+ * token of its pointer names the value's key or index.
+ */
+
+uint64_t
+json_fields_enter(struct json_fields *fields, uint64_t *ended)
+{
+    size_t depth = fields->depth;
+    uint64_t reached;
+
+    if (depth == 0) {
+        reached = fields->all;
+    } else {
+        struct json_field_frame *frame = &fields->frames[depth];
+        uint64_t parent = frame->fields;
+        size_t index = frame->index++;
+        reached = 0;
+
+        for (size_t i = 0; parent; i++, parent >>= 1) {
+            if (!(parent & 1)) continue;
+
+            const struct json_pointer_token *step =
+                &fields->pointers[i]->tokens[depth - 1];
+            bool matches = frame->array
+                         ? step->index == index
+                         : step->length == fields->key_length
+                           && memcmp(step->key, fields->key, step->length) == 0;
+            if (matches)
+                reached |= (uint64_t)1 << i;
+        }
+    }
+
+    *ended = 0;
+    uint64_t bits = reached;
+    for (size_t i = 0; bits; i++, bits >>= 1) {
+        if ((bits & 1) && fields->pointers[i]->count == depth)
+            *ended |= (uint64_t)1 << i;
+    }
+    return reached & ~*ended;
+}
+
+void
+json_fields_open(struct json_fields *fields, uint64_t within, bool array)
+{
+    struct json_field_frame *frame = &fields->frames[++fields->depth];
+    frame->fields = within;
+    frame->index = 0;
+    frame->array = array;
+}
+
+bool
+json_fields_key(struct json_fields *fields, const uint8_t *text, size_t length)
+{
+    if (!fields->frames[fields->depth].fields) return true;
+
+    free(fields->decoded);
+    fields->key = json_read_text(text, length, &fields->key_length,
+                                 &fields->decoded);
+    return fields->key != NULL;
+}
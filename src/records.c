@@ -0,0 +1,500 @@
+/**
+ * Filtering streams of records.
+ *
+ * A record stream is newline-delimited JSON, one value after another, or the
+ * elements of a single top-level array.  A predicate such as
+ *
+ *   /level == "error" && /latency > 500 || /fatal == true
+ *
+ * is a disjunction of conjunctions of terms, each of which compares the field
+ * of a record named by a JSON Pointer with a JSON literal.
+ *
+ * Records are read with the in-memory reader.  Each term is decided from the
+ * raw lexeme of its field as soon as the field is reached, and once the
+ * predicate is known to hold or to fail, the rest of the record is skipped
+ * by matching brackets.  No value is created for a rejected record, and an
+ * accepted one is opened as an on-demand document only to hand it over.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PREDICATE_MAX_TERMS 64
+
+struct predicate_term {
+    enum json_compare compare;
+    enum json_token token;
+    double number;
+    uint8_t *string;
+    size_t length;
+};
+
+struct json_predicate {
+    size_t count;
+    size_t groups;
+    uint64_t group[PREDICATE_MAX_TERMS];
+    struct json_pointer *fields[PREDICATE_MAX_TERMS];
+    struct predicate_term terms[PREDICATE_MAX_TERMS];
+};
+
+/**
+ * Compiling predicates.
+ */
+
+/**
+ * Fields extend up to the first space or comparison operator, and literals
+ * are single JSON scalars read with the reader itself.  Only numbers and
+ * strings may be ordered.
+ */
+
+static bool
+parse_term(const uint8_t **cursor, struct json_pointer **field,
+           struct predicate_term *term)
+{
+    const uint8_t *p = *cursor;
+    if (*p != '/') return false;
+
+    const uint8_t *start = p;
+    while (*p && !strchr(" \t\n\r=!<>", *p)) p++;
+
+    uint8_t *text = malloc(p - start + 1);
+    if (!text) return false;
+
+    memcpy(text, start, p - start);
+    text[p - start] = '\0';
+    *field = json_pointer_compile(text);
+    free(text);
+    if (!*field) return false;
+
+    p = json_skip_space(p);
+    term->compare = json_parse_compare(&p);
+    if (term->compare == JSON_COMPARE_NONE) return false;
+    p = json_skip_space(p);
+
+    struct json_reader reader;
+    json_reader_init(&reader, p, strlen((const char *)p));
+    term->token = json_reader_next(&reader);
+
+    switch (term->token) {
+        case JSON_TOKEN_STRING:
+            term->string = json_read_string(reader.token, reader.length);
+            if (!term->string) return false;
+            term->length = strlen((const char *)term->string);
+            break;
+        case JSON_TOKEN_NUMBER:
+            term->number = json_read_number(reader.token, reader.length);
+            break;
+        case JSON_TOKEN_TRUE:
+        case JSON_TOKEN_FALSE:
+        case JSON_TOKEN_NULL:
+            if (term->compare != JSON_COMPARE_EQUAL
+                && term->compare != JSON_COMPARE_NOT_EQUAL)
+                return false;
+            break;
+        default:
+            return false;
+    }
+
+    *cursor = reader.cursor;
+    return true;
+}
+
+struct json_predicate *
+json_predicate_compile(const uint8_t *text)
+{
+    if (!text) return NULL;
+
+    struct json_predicate *predicate = calloc(1, sizeof(*predicate));
+    if (!predicate) return NULL;
+
+    const uint8_t *p = text;
+    predicate->groups = 1;
+
+    for (;;) {
+        if (predicate->count == PREDICATE_MAX_TERMS) goto fail;
+
+        size_t index = predicate->count++;
+        p = json_skip_space(p);
+        if (!parse_term(&p, &predicate->fields[index], &predicate->terms[index]))
+            goto fail;
+
+        predicate->group[predicate->groups - 1] |= (uint64_t)1 << index;
+
+        p = json_skip_space(p);
+        if (*p == '\0') break;
+
+        if (p[0] == '|' && p[1] == '|')
+            predicate->groups++;
+        else if (p[0] != '&' || p[1] != '&')
+            goto fail;
+        p += 2;
+    }
+    return predicate;
+
+fail:
+    json_predicate_free(predicate);
+    return NULL;
+}
+
+void
+json_predicate_free(struct json_predicate *predicate)
+{
+    if (!predicate) return;
+
+    for (size_t i = 0; i < predicate->count; i++) {
+        json_pointer_free(predicate->fields[i]);
+        free(predicate->terms[i].string);
+    }
+    free(predicate);
+}
+
+/**
+ * Evaluating terms.
+ *
+ * A field holding a value of another kind than the literal is unequal to it
+ * and neither less nor greater, and so is a field missing from the record.
+ */
+
+static int
+string_order(const struct predicate_term *term, const uint8_t *text,
+             size_t length)
+{
+    size_t size;
+    uint8_t *decoded;
+    const uint8_t *bytes = json_read_text(text, length, &size, &decoded);
+    if (!bytes) return -1;
+
+    int order = memcmp(bytes, term->string, size < term->length ? size : term->length);
+    if (order == 0) order = (size > term->length) - (size < term->length);
+
+    free(decoded);
+    return order;
+}
+
+static bool
+term_holds(const struct predicate_term *term, enum json_token token,
+           const uint8_t *text, size_t length)
+{
+    if (token != term->token)
+        return term->compare == JSON_COMPARE_NOT_EQUAL;
+
+    int order = 0;
+    if (token == JSON_TOKEN_NUMBER) {
+        double value = json_read_number(text, length);
+        order = (value > term->number) - (value < term->number);
+    }
+    else if (token == JSON_TOKEN_STRING) {
+        order = string_order(term, text, length);
+    }
+    return json_compare_order(term->compare, order);
+}
+
+/**
+ * Filtering records.
+ *
+ * Each open container keeps the terms whose field may lie within it.  A term
+ * is decided when the value at the end of its field starts; a predicate is
+ * decided when one conjunction has only true terms, or every conjunction has
+ * a false one.
+ */
+
+struct record_filter {
+    const struct json_predicate *predicate;
+
+    const uint8_t *start;
+    struct json_fields fields;
+
+    uint64_t seen;
+    uint64_t truth;
+    bool decided;
+    bool accepted;
+};
+
+static void
+record_decide(struct record_filter *filter)
+{
+    const struct json_predicate *predicate = filter->predicate;
+    bool possible = false;
+
+    for (size_t g = 0; g < predicate->groups; g++) {
+        uint64_t terms = predicate->group[g];
+
+        if ((filter->truth & terms) == terms) {
+            filter->decided = true;
+            filter->accepted = true;
+            return;
+        }
+        if (!(filter->seen & ~filter->truth & terms))
+            possible = true;
+    }
+
+    if (!possible) {
+        filter->decided = true;
+        filter->accepted = false;
+    }
+}
+
+/**
+ * Starts a value and decides the terms whose field ends at it.  Returns the
+ * terms whose field lies further within it.
+ */
+
+static uint64_t
+record_value(struct record_filter *filter, enum json_token token,
+             const uint8_t *text, size_t length)
+{
+    const struct json_predicate *predicate = filter->predicate;
+    if (filter->fields.depth == 0) filter->start = text;
+
+    uint64_t ended;
+    uint64_t within = json_fields_enter(&filter->fields, &ended);
+
+    uint64_t bits = ended;
+    for (size_t i = 0; bits; i++, bits >>= 1) {
+        uint64_t bit = (uint64_t)1 << i;
+        if (!(bits & 1) || (filter->seen & bit)) continue;
+
+        filter->seen |= bit;
+        if (term_holds(&predicate->terms[i], token, text, length))
+            filter->truth |= bit;
+    }
+
+    if (ended || filter->fields.depth == 0) record_decide(filter);
+    return within;
+}
+
+static bool
+record_begin(void *context, const uint8_t *at)
+{
+    struct record_filter *filter = context;
+    struct json_fields *fields = &filter->fields;
+
+    enum json_token token = (*at == '{') ? JSON_TOKEN_BEGIN_OBJECT
+                                         : JSON_TOKEN_BEGIN_ARRAY;
+    uint64_t within = 0;
+    if (fields->depth == 0 || fields->frames[fields->depth].fields)
+        within = record_value(filter, token, at, 1);
+
+    json_fields_open(fields, within, token == JSON_TOKEN_BEGIN_ARRAY);
+    return !filter->decided;
+}
+
+static bool
+record_end(void *context, const uint8_t *at)
+{
+    struct record_filter *filter = context;
+    (void)at;
+
+    filter->fields.depth--;
+    return true;
+}
+
+static bool
+record_key(void *context, const uint8_t *text, size_t length)
+{
+    struct record_filter *filter = context;
+    return json_fields_key(&filter->fields, text, length);
+}
+
+static bool
+record_scalar(void *context, const uint8_t *text, size_t length)
+{
+    struct record_filter *filter = context;
+
+    enum json_token token;
+    switch (*text) {
+        case '"': token = JSON_TOKEN_STRING; break;
+        case 't': token = JSON_TOKEN_TRUE;   break;
+        case 'f': token = JSON_TOKEN_FALSE;  break;
+        case 'n': token = JSON_TOKEN_NULL;   break;
+        default:  token = JSON_TOKEN_NUMBER; break;
+    }
+
+    struct json_fields *fields = &filter->fields;
+    if (fields->depth == 0 || fields->frames[fields->depth].fields)
+        record_value(filter, token, text, length);
+
+    return !filter->decided;
+}
+
+static const struct json_events record_events = {
+    .begin  = record_begin,
+    .end    = record_end,
+    .key    = record_key,
+    .scalar = record_scalar,
+};
+
+/**
+ * Reads one record and decides it, skipping whatever follows the decision.
+ * Terms never reached are decided as missing fields at the end.
+ */
+
+static bool
+record_read(struct record_filter *filter, struct json_reader *reader)
+{
+    filter->fields.depth = 0;
+    filter->seen = 0;
+    filter->truth = 0;
+    filter->decided = false;
+    filter->accepted = false;
+
+    if (json_reader_walk(reader, &record_events, filter)) {
+        if (filter->decided) return true;
+
+        const struct json_predicate *predicate = filter->predicate;
+        for (size_t i = 0; i < predicate->count; i++) {
+            uint64_t bit = (uint64_t)1 << i;
+            if (!(filter->seen & bit) && predicate->terms[i].compare == JSON_COMPARE_NOT_EQUAL)
+                filter->truth |= bit;
+        }
+        filter->seen = ~(uint64_t)0;
+        record_decide(filter);
+        return true;
+    }
+
+    /* An undecided record stops the walk only if a key cannot be decoded. */
+    if (!filter->decided) {
+        if (reader->status == JSON_SUCCESS) reader->status = JSON_OUT_OF_MEMORY;
+        return false;
+    }
+    return json_reader_skip(reader, filter->fields.depth);
+}
+
+/**
+ * Record streams.
+ *
+ * In an array, the reader is moved past the separator before each record and
+ * past the closing bracket after the last one.  A stream ends cleanly only
+ * if nothing but whitespace follows.
+ */
+
+void
+json_records_init(struct json_record_stream *stream, const uint8_t *buffer,
+                  size_t length, enum json_records layout)
+{
+    json_reader_init(&stream->reader, buffer, length);
+    stream->layout = layout;
+    stream->started = false;
+}
+
+static bool
+records_more(struct json_reader *reader)
+{
+    const uint8_t *p = reader->cursor;
+    while (p < reader->end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    reader->cursor = p;
+    return p < reader->end;
+}
+
+static bool
+records_fail(struct json_reader *reader, enum json_token token)
+{
+    if (token != JSON_TOKEN_ERROR) {
+        reader->cursor = reader->token;
+        reader->status = (token == JSON_TOKEN_END) ? JSON_UNEXPECTED_FILE_END
+                                                   : JSON_UNEXPECTED_CHARACTER;
+    }
+    return false;
+}
+
+static bool
+records_close(struct json_reader *reader)
+{
+    enum json_token token = json_reader_next(reader);
+    if (token != JSON_TOKEN_END) records_fail(reader, token);
+    return false;
+}
+
+bool
+json_records_next(struct json_record_stream *stream)
+{
+    struct json_reader *reader = &stream->reader;
+    enum json_token token;
+
+    if (stream->layout == JSON_RECORDS_LINES)
+        return records_more(reader);
+
+    if (!stream->started) {
+        stream->started = true;
+        if ((token = json_reader_next(reader)) != JSON_TOKEN_BEGIN_ARRAY)
+            return records_fail(reader, token);
+        if (records_more(reader) && *reader->cursor == ']') {
+            reader->cursor++;
+            return records_close(reader);
+        }
+        return true;
+    }
+
+    token = json_reader_next(reader);
+    if (token == JSON_TOKEN_END_ARRAY) return records_close(reader);
+    if (token != JSON_TOKEN_COMMA) return records_fail(reader, token);
+    return true;
+}
+
+static bool
+records_filter(struct record_filter *filter, struct json_record_stream *stream,
+               size_t *accepted,
+               bool (*visit)(void *context, const struct json *record),
+               void *context)
+{
+    struct json_reader *reader = &stream->reader;
+
+    while (json_records_next(stream)) {
+        if (!record_read(filter, reader)) return false;
+        if (!filter->accepted) continue;
+
+        enum json_status status;
+        struct json_doc *doc = json_doc_open(filter->start,
+                                             reader->cursor - filter->start,
+                                             &status);
+        if (!doc) {
+            reader->cursor = filter->start;
+            reader->status = status;
+            return false;
+        }
+
+        ++*accepted;
+        bool more = visit(context, json_doc_root(doc));
+        json_doc_close(doc);
+        if (!more) return true;
+    }
+    return reader->status == JSON_SUCCESS;
+}
+
+size_t
+json_records_filter(const uint8_t *buffer, size_t length,
+                    enum json_records layout,
+                    const struct json_predicate *predicate,
+                    bool (*visit)(void *context, const struct json *record),
+                    void *context, enum json_status *status)
+{
+    static const struct json_predicate everything = { .count = 0, .groups = 1 };
+
+    struct record_filter *filter = calloc(1, sizeof(*filter));
+    if (!filter) {
+        *status = JSON_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    filter->predicate = predicate ? predicate : &everything;
+
+    size_t count = filter->predicate->count;
+    filter->fields.pointers = filter->predicate->fields;
+    filter->fields.all = (count == PREDICATE_MAX_TERMS)
+                       ? ~(uint64_t)0 : ((uint64_t)1 << count) - 1;
+
+    struct json_record_stream stream;
+    json_records_init(&stream, buffer, length, layout);
+
+    size_t accepted = 0;
+    bool valid = records_filter(filter, &stream, &accepted, visit, context);
+    *status = valid ? JSON_SUCCESS : stream.reader.status;
+
+    free(filter->fields.decoded);
+    free(filter);
+    return accepted;
+}
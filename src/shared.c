@@ -0,0 +1,138 @@
+/**
+ * Frozen values shared between threads.
+ *
+ * Freezing a tree makes every value in it immutable and gives each one an
+ * atomic reference count, held at first by its parent or, for the root, by
+ * the caller.  A subtree can then be handed to another thread by taking one
+ * more reference, and each holder releases its own.  Freeing a value drops
+ * its reference, and only the last one frees it and drops its children's.
+ *
+ * Reads never modify a frozen tree, so the tree is prepared first: pending
+ * values are expanded, packed arrays are unpacked, and interned keys are
+ * replaced by private copies, since key pools are not safe to share.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool
+freeze_key(struct json_member *member)
+{
+    if (!member->interned) return true;
+
+    uint8_t *copy = malloc(member->length + 1);
+    if (!copy) return false;
+
+    memcpy(copy, member->key, member->length + 1);
+    json_keys_release(member->key);
+    member->key = copy;
+    member->interned = false;
+    return true;
+}
+
+/**
+ * Brings a tree into the form it keeps once frozen.  On failure, the tree is
+ * left valid but not frozen.
+ */
+
+static bool
+freeze_prepare(struct json *json)
+{
+    if (json->tag & JSON_TAG_FROZEN) return true;
+    if (!json_resolve(json)) return false;
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT:
+            if (!json->data.object) return true;
+
+            for (struct json_member *member = json->data.object->members;
+                 member; member = member->next) {
+                if (!freeze_key(member) || !freeze_prepare(member->value))
+                    return false;
+            }
+            return true;
+        case JSON_TYPE_ARRAY:
+            if (!json_array_unpack(json)) return false;
+            if (!json->data.array) return true;
+
+            for (size_t i = 0; i < json->data.array->count; i++) {
+                if (!freeze_prepare(json->data.array->items[i]))
+                    return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+static void
+freeze_mark(struct json *json)
+{
+    if (json->tag & JSON_TAG_FROZEN) return;
+
+    json->tag |= JSON_TAG_FROZEN;
+    if (!(json->tag & JSON_TAG_INLINE))
+        json->aux = 1;
+
+    switch (json_kind(json)) {
+        case JSON_TYPE_OBJECT:
+            if (!json->data.object) return;
+
+            for (struct json_member *member = json->data.object->members;
+                 member; member = member->next)
+                freeze_mark(member->value);
+            return;
+        case JSON_TYPE_ARRAY:
+            if (!json->data.array) return;
+
+            for (size_t i = 0; i < json->data.array->count; i++)
+                freeze_mark(json->data.array->items[i]);
+            return;
+        default:
+            return;
+    }
+}
+
+bool
+json_freeze(struct json *json)
+{
+    if (!json) return false;
+    if (!freeze_prepare(json)) return false;
+
+    freeze_mark(json);
+    return true;
+}
+
+bool
+json_is_frozen(const struct json *json)
+{
+    return json && (json->tag & JSON_TAG_FROZEN);
+}
+
+/**
+ * Inline strings have no room for a count, so taking a reference to one
+ * returns a copy instead, which is just as cheap and just as immutable.
+ */
+
+struct json *
+json_retain(struct json *json)
+{
+    if (!json || !(json->tag & JSON_TAG_FROZEN)) return NULL;
+
+    if (json->tag & JSON_TAG_INLINE) {
+        struct json *copy = malloc(sizeof(*copy));
+        if (copy) *copy = *json;
+        return copy;
+    }
+
+    __atomic_add_fetch(&json->aux, 1, __ATOMIC_RELAXED);
+    return json;
+}
+
+void
+json_release(struct json *json)
+{
+    json_free(json);
+}
@@ -0,0 +1,535 @@
+/**
+ * Flat, immutable document representation.
+ *
+ * A tape stores a parsed document as one contiguous array of 64-bit words in
+ * document order, plus one buffer holding every decoded string.  Each word
+ * carries a type tag in its top byte and a 56-bit payload:
+ *
+ *   '{' '['   start of a container; payload is the index just past its end
+ *   '}' ']'   end of a container; payload is the number of members/elements
+ *   '"'       string or key; payload is its offset in the string buffer
+ *   'd'       number; the following word holds the bits of the double
+ *   't' 'f' 'n'  literals; no payload
+ *
+ * Strings in the buffer are stored as a 32-bit length followed by the bytes
+ * and a terminating NUL.  Traversal reads the tape sequentially, skipping a
+ * whole container in one step, and neither array depends on addresses, so a
+ * tape can be written out and read back as is.
+ */
+
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TAPE_TAG(word)      ((uint8_t)((word) >> 56))
+#define TAPE_PAYLOAD(word)  ((word) & 0x00FFFFFFFFFFFFFFULL)
+#define TAPE_WORD(tag, payload) (((uint64_t)(tag) << 56) | (payload))
+
+struct json_tape {
+    uint64_t *words;
+    size_t count;
+    size_t capacity;
+
+    uint8_t *strings;
+    size_t length;
+    size_t reserved;
+};
+
+/**
+ * Building a tape.
+ *
+ * The reader reports the document in order, so words are appended as events
+ * arrive.  Open containers are kept on a stack with their member counts until
+ * the closing bracket patches the start word.
+ */
+
+struct tape_builder {
+    struct json_tape *tape;
+    size_t depth;
+    size_t open[JSON_MAX_DEPTH];
+    size_t members[JSON_MAX_DEPTH];
+};
+
+static bool
+tape_append(struct json_tape *tape, uint64_t word)
+{
+    if (tape->count == tape->capacity) {
+        size_t request = tape->capacity ? tape->capacity * 2 : 64;
+        void *resized = realloc(tape->words, request * sizeof(*tape->words));
+        if (!resized) return false;
+
+        tape->words = resized;
+        tape->capacity = request;
+    }
+
+    tape->words[tape->count++] = word;
+    return true;
+}
+
+static bool
+strings_reserve(struct json_tape *tape, size_t n)
+{
+    if (tape->length + n <= tape->reserved) return true;
+
+    size_t request = tape->reserved ? tape->reserved : 256;
+    while (request < tape->length + n) request *= 2;
+
+    void *resized = realloc(tape->strings, request);
+    if (!resized) return false;
+
+    tape->strings = resized;
+    tape->reserved = request;
+    return true;
+}
+
+/**
+ * Appends a string lexeme, quotes included, to the string buffer and a word
+ * referencing it to the tape.  Strings without escapes are copied directly.
+ */
+
+static bool
+tape_string(struct json_tape *tape, const uint8_t *text, size_t length)
+{
+    size_t size;
+    uint8_t *decoded;
+    const uint8_t *body = json_read_text(text, length, &size, &decoded);
+    if (!body) return false;
+
+    uint32_t prefix = (uint32_t)size;
+    size_t offset = tape->length;
+
+    bool stored = size <= UINT32_MAX
+               && strings_reserve(tape, sizeof(prefix) + size + 1)
+               && tape_append(tape, TAPE_WORD('"', offset));
+
+    if (stored) {
+        memcpy(tape->strings + offset, &prefix, sizeof(prefix));
+        memcpy(tape->strings + offset + sizeof(prefix), body, size);
+        tape->strings[offset + sizeof(prefix) + size] = '\0';
+        tape->length += sizeof(prefix) + size + 1;
+    }
+
+    free(decoded);
+    return stored;
+}
+
+static void
+count_member(struct tape_builder *builder)
+{
+    if (builder->depth > 0)
+        builder->members[builder->depth - 1]++;
+}
+
+static bool
+on_begin(void *context, const uint8_t *at)
+{
+    struct tape_builder *builder = context;
+    count_member(builder);
+
+    builder->open[builder->depth] = builder->tape->count;
+    builder->members[builder->depth] = 0;
+    builder->depth++;
+
+    return tape_append(builder->tape, TAPE_WORD(*at, 0));
+}
+
+static bool
+on_end(void *context, const uint8_t *at)
+{
+    struct tape_builder *builder = context;
+    struct json_tape *tape = builder->tape;
+
+    builder->depth--;
+    size_t start = builder->open[builder->depth];
+    size_t members = builder->members[builder->depth];
+
+    if (!tape_append(tape, TAPE_WORD(*at, members))) return false;
+    tape->words[start] = TAPE_WORD(TAPE_TAG(tape->words[start]), tape->count);
+    return true;
+}
+
+static bool
+on_key(void *context, const uint8_t *text, size_t length)
+{
+    struct tape_builder *builder = context;
+    return tape_string(builder->tape, text, length);
+}
+
+static bool
+on_scalar(void *context, const uint8_t *text, size_t length)
+{
+    struct tape_builder *builder = context;
+    struct json_tape *tape = builder->tape;
+    count_member(builder);
+
+    switch (text[0]) {
+        case '"':
+            return tape_string(tape, text, length);
+        case 't':
+        case 'f':
+        case 'n':
+            return tape_append(tape, TAPE_WORD(text[0], 0));
+        default: {
+            double number = json_read_number(text, length);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return tape_append(tape, TAPE_WORD('d', 0))
+                && tape_append(tape, bits);
+        }
+    }
+}
+
+static const struct json_events tape_events = {
+    .begin  = on_begin,
+    .end    = on_end,
+    .key    = on_key,
+    .scalar = on_scalar,
+};
+
+struct json_tape *
+json_tape_parse(const uint8_t *buffer, size_t length, enum json_status *status)
+{
+    *status = JSON_OUT_OF_MEMORY;
+
+    struct json_tape *tape = calloc(1, sizeof(*tape));
+    if (!tape) return NULL;
+
+    struct tape_builder builder;
+    builder.tape = tape;
+    builder.depth = 0;
+
+    struct json_reader reader;
+    json_reader_init(&reader, buffer, length);
+
+    /*
+     * The walk stops without an error in the text only when the tape or its
+     * strings cannot grow.
+     */
+    if (!json_reader_walk(&reader, &tape_events, &builder)) {
+        if (reader.status != JSON_SUCCESS) *status = reader.status;
+        json_tape_free(tape);
+        return NULL;
+    }
+    if (json_reader_next(&reader) != JSON_TOKEN_END) {
+        *status = (reader.status != JSON_SUCCESS) ? reader.status
+                                                  : JSON_UNEXPECTED_CHARACTER;
+        json_tape_free(tape);
+        return NULL;
+    }
+
+    *status = JSON_SUCCESS;
+    return tape;
+}
+
+void
+json_tape_free(struct json_tape *tape)
+{
+    if (!tape) return;
+    free(tape->words);
+    free(tape->strings);
+    free(tape);
+}
+
+/**
+ * Traversal.
+ *
+ * Values are identified by their index on the tape.  The root is at index 0,
+ * the first member or element of a container follows its start word, and
+ * json_tape_next steps over a complete value, container or not.
+ */
+
+static bool
+tape_valid(const struct json_tape *tape, size_t at)
+{
+    if (!tape || at >= tape->count) return false;
+
+    uint8_t tag = TAPE_TAG(tape->words[at]);
+    return tag != '}' && tag != ']';
+}
+
+enum json_type
+json_tape_type(const struct json_tape *tape, size_t at)
+{
+    if (!tape_valid(tape, at)) return JSON_TYPE_NULL;
+
+    switch (TAPE_TAG(tape->words[at])) {
+        case '{': return JSON_TYPE_OBJECT;
+        case '[': return JSON_TYPE_ARRAY;
+        case '"': return JSON_TYPE_STRING;
+        case 'd': return JSON_TYPE_NUMBER;
+        case 't': return JSON_TYPE_BOOLEAN;
+        case 'f': return JSON_TYPE_BOOLEAN;
+        default:  return JSON_TYPE_NULL;
+    }
+}
+
+size_t
+json_tape_next(const struct json_tape *tape, size_t at)
+{
+    if (!tape_valid(tape, at)) return JSON_TAPE_NONE;
+
+    uint64_t word = tape->words[at];
+
+    switch (TAPE_TAG(word)) {
+        case '{':
+        case '[': return TAPE_PAYLOAD(word);
+        case 'd': return at + 2;
+        default:  return at + 1;
+    }
+}
+
+size_t
+json_tape_first(const struct json_tape *tape, size_t at)
+{
+    if (!tape_valid(tape, at)) return JSON_TAPE_NONE;
+
+    uint8_t tag = TAPE_TAG(tape->words[at]);
+    if (tag != '{' && tag != '[') return JSON_TAPE_NONE;
+
+    size_t first = at + 1;
+    return tape_valid(tape, first) ? first : JSON_TAPE_NONE;
+}
+
+size_t
+json_tape_length(const struct json_tape *tape, size_t at)
+{
+    if (!tape_valid(tape, at)) return 0;
+
+    uint64_t word = tape->words[at];
+    uint8_t tag = TAPE_TAG(word);
+    if (tag != '{' && tag != '[') return 0;
+
+    return TAPE_PAYLOAD(tape->words[TAPE_PAYLOAD(word) - 1]);
+}
+
+size_t
+json_tape_object_get(const struct json_tape *tape, size_t at,
+                     const uint8_t *key)
+{
+    if (!tape_valid(tape, at) || TAPE_TAG(tape->words[at]) != '{')
+        return JSON_TAPE_NONE;
+
+    size_t end = TAPE_PAYLOAD(tape->words[at]) - 1;
+    size_t length = strlen((const char *)key);
+
+    for (size_t i = at + 1; i < end; ) {
+        size_t size;
+        const uint8_t *name = json_tape_string(tape, i, &size);
+        if (!name) return JSON_TAPE_NONE;
+
+        size_t value = i + 1;
+        if (size == length && memcmp(name, key, length) == 0)
+            return value;
+        i = json_tape_next(tape, value);
+    }
+    return JSON_TAPE_NONE;
+}
+
+size_t
+json_tape_array_get(const struct json_tape *tape, size_t at, size_t index)
+{
+    if (!tape_valid(tape, at) || TAPE_TAG(tape->words[at]) != '[')
+        return JSON_TAPE_NONE;
+
+    size_t end = TAPE_PAYLOAD(tape->words[at]) - 1;
+    size_t i = at + 1;
+
+    for (; i < end && index > 0; index--)
+        i = json_tape_next(tape, i);
+
+    return (i < end) ? i : JSON_TAPE_NONE;
+}
+
+const uint8_t *
+json_tape_string(const struct json_tape *tape, size_t at, size_t *length)
+{
+    if (!tape_valid(tape, at) || TAPE_TAG(tape->words[at]) != '"')
+        return NULL;
+
+    const uint8_t *entry = tape->strings + TAPE_PAYLOAD(tape->words[at]);
+
+    uint32_t size;
+    memcpy(&size, entry, sizeof(size));
+    if (length) *length = size;
+    return entry + sizeof(size);
+}
+
+double
+json_tape_number(const struct json_tape *tape, size_t at)
+{
+    if (!tape_valid(tape, at) || TAPE_TAG(tape->words[at]) != 'd')
+        return 0;
+
+    double number;
+    memcpy(&number, &tape->words[at + 1], sizeof(number));
+    return number;
+}
+
+bool
+json_tape_boolean(const struct json_tape *tape, size_t at)
+{
+    return tape_valid(tape, at) && TAPE_TAG(tape->words[at]) == 't';
+}
+
+/**
+ * Serialization.
+ *
+ * A tape is written as a small header followed by the two arrays exactly as
+ * they are held in memory, in the byte order of the host.
+ */
+
+static const char tape_magic[8] = "JSONTAPE";
+
+bool
+json_tape_write(const struct json_tape *tape, FILE *out)
+{
+    uint64_t header[2] = { tape->count, tape->length };
+
+    return fwrite(tape_magic, sizeof(tape_magic), 1, out) == 1
+        && fwrite(header, sizeof(header), 1, out) == 1
+        && fwrite(tape->words, sizeof(*tape->words), tape->count, out) == tape->count
+        && fwrite(tape->strings, 1, tape->length, out) == tape->length;
+}
+
+/**
+ * A tape read back from a file is checked before use, since traversal
+ * trusts it: every tag must be known, containers must nest, end at their
+ * matching close word and hold the member count it records, object members
+ * must be a string key followed by a value, and strings must lie within the
+ * string buffer and end in a NUL.
+ */
+
+struct tape_frame {
+    size_t end;
+    size_t members;
+    bool object;
+    bool key;
+};
+
+static bool
+tape_check_string(const struct json_tape *tape, uint64_t offset)
+{
+    uint32_t size;
+    if (offset > tape->length || tape->length - offset < sizeof(size))
+        return false;
+
+    memcpy(&size, tape->strings + offset, sizeof(size));
+    size_t rest = tape->length - offset - sizeof(size);
+    return size < rest && tape->strings[offset + sizeof(size) + size] == '\0';
+}
+
+static bool
+tape_check(const struct json_tape *tape)
+{
+    struct tape_frame stack[JSON_MAX_DEPTH];
+    size_t depth = 0;
+
+    for (size_t i = 0; i < tape->count; ) {
+        uint64_t word = tape->words[i];
+        uint8_t tag = TAPE_TAG(word);
+        struct tape_frame *frame = depth ? &stack[depth - 1] : NULL;
+
+        if (frame && i == frame->end - 1) {
+            if (tag != (frame->object ? '}' : ']') || TAPE_PAYLOAD(word) != frame->members
+                || (frame->object && !frame->key))
+                return false;
+            depth--;
+            i++;
+            continue;
+        }
+        if (!frame && i > 0) return false;
+
+        if (frame && frame->object && frame->key) {
+            if (tag != '"' || !tape_check_string(tape, TAPE_PAYLOAD(word)))
+                return false;
+            frame->key = false;
+            i++;
+            continue;
+        }
+
+        if (frame) {
+            frame->members++;
+            frame->key = frame->object;
+        }
+        size_t limit = frame ? frame->end - 1 : tape->count;
+
+        switch (tag) {
+            case '{':
+            case '[': {
+                uint64_t end = TAPE_PAYLOAD(word);
+                if (end < i + 2 || end > limit || depth == JSON_MAX_DEPTH)
+                    return false;
+                stack[depth++] = (struct tape_frame) { end, 0, tag == '{', tag == '{' };
+                i++;
+                break;
+            }
+            case '"':
+                if (!tape_check_string(tape, TAPE_PAYLOAD(word))) return false;
+                i++;
+                break;
+            case 'd':
+                if (limit - i < 2) return false;
+                i += 2;
+                break;
+            case 't':
+            case 'f':
+            case 'n':
+                i++;
+                break;
+            default:
+                return false;
+        }
+    }
+    return depth == 0;
+}
+
+/**
+ * The header must also agree with the size of a file that can be measured,
+ * and nothing may follow the string buffer.
+ */
+
+static bool
+tape_fits(FILE *in, uint64_t count, uint64_t length)
+{
+    long start = ftell(in);
+    if (start < 0 || fseek(in, 0, SEEK_END) != 0) return true;
+
+    long end = ftell(in);
+    bool fits = end >= start
+             && (uint64_t)(end - start) / sizeof(uint64_t) >= count
+             && (uint64_t)(end - start) - count * sizeof(uint64_t) == length;
+
+    return fseek(in, start, SEEK_SET) == 0 && fits;
+}
+
+struct json_tape *
+json_tape_read(FILE *in)
+{
+    char magic[sizeof(tape_magic)];
+    uint64_t header[2];
+
+    if (fread(magic, sizeof(magic), 1, in) != 1
+     || memcmp(magic, tape_magic, sizeof(magic)) != 0
+     || fread(header, sizeof(header), 1, in) != 1
+     || header[0] == 0 || header[0] > SIZE_MAX / sizeof(uint64_t)
+     || header[1] >= SIZE_MAX || !tape_fits(in, header[0], header[1]))
+        return NULL;
+
+    struct json_tape *tape = calloc(1, sizeof(*tape));
+    if (!tape) return NULL;
+
+    tape->count = tape->capacity = header[0];
+    tape->length = tape->reserved = header[1];
+    tape->words = malloc(tape->count * sizeof(*tape->words));
+    tape->strings = malloc(tape->length ? tape->length : 1);
+
+    if (!tape->words || !tape->strings
+     || fread(tape->words, sizeof(*tape->words), tape->count, in) != tape->count
+     || fread(tape->strings, 1, tape->length, in) != tape->length
+     || fgetc(in) != EOF || !tape_check(tape)) {
+        json_tape_free(tape);
+        return NULL;
+    }
+    return tape;
+}
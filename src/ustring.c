@@ -29,11 +29,12 @@ ustring_new(size_t capacity)
     result->capacity = 0;
     result->length = 0;
     
-    if (!ustring_reserve(result, capacity)) {
+    if (capacity == SIZE_MAX || !ustring_reserve(result, capacity + 1)) {
         free(result);
         return NULL;
     }
     
+    result->data[0] = '\0';
     return result;
 }
 
@@ -31,6 +31,11 @@ uint8_t *ustring_take_string(struct ustring *string);
  */
 bool decode_next_UTF8(const uint8_t **ptr, const uint8_t *end, uint32_t *out);
 
+/**
+ * Returns true if the bytes from `p` to `end` are all well-formed UTF-8.
+ */
+bool valid_UTF8(const uint8_t *p, const uint8_t *end);
+
 /**
  * Decodes a JSON string with escape sequences into a UTF-8 string.
  *
@@ -0,0 +1,49 @@
+/**
+ * Aggregates over as many fields as they can follow, plus a group field.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+
+int
+main(void)
+{
+    char names[63][8], records[4096];
+    const uint8_t *fields[63];
+    size_t r = 0;
+
+    for (int i = 0; i < 63; i++) {
+        sprintf(names[i], "/f%d", i);
+        fields[i] = (const uint8_t *)names[i];
+    }
+
+    for (int record = 0; record < 3; record++) {
+        r += sprintf(records + r, "{\"g\": \"%s\"", record ? "b" : "a");
+        for (int i = 0; i < 63; i++)
+            r += sprintf(records + r, ", \"f%d\": %d", i, i + record);
+        r += sprintf(records + r, "}\n");
+    }
+
+    struct json_aggregate *aggregate =
+        json_aggregate_new((const uint8_t *)"/g", fields, 63);
+    assert(aggregate);
+
+    enum json_status status;
+    assert(json_aggregate_records(aggregate, (const uint8_t *)records, r,
+                                  JSON_RECORDS_LINES, &status));
+    assert(status == JSON_SUCCESS);
+
+    struct json *result = json_aggregate_result(aggregate);
+    struct json *b = json_object_get(result, (const uint8_t *)"b");
+    assert(json_get_number(json_object_get(b, (const uint8_t *)"count")) == 2);
+
+    struct json *last = json_object_get(b, (const uint8_t *)"/f62");
+    assert(json_get_number(json_object_get(last, (const uint8_t *)"sum")) == 63 + 64);
+
+    json_free(result);
+    json_aggregate_free(aggregate);
+    return 0;
+}
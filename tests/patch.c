@@ -0,0 +1,69 @@
+/**
+ * JSON Patch operations that fail must leave the target as it was.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+
+static struct json *
+parse(const char *text)
+{
+    FILE *in = fmemopen((void *)text, strlen(text), "r");
+    enum json_status status;
+    struct json *json = json_parse(in, &status);
+    fclose(in);
+    assert(json && status == JSON_SUCCESS);
+    return json;
+}
+
+static void
+check_patch(const char *target, const char *ops, bool applied, const char *result)
+{
+    struct json *json = parse(target);
+    struct json *patch = parse(ops);
+    struct json *expected = parse(result);
+
+    assert(json_patch_apply(json, patch) == applied);
+    assert(json_equal(json, expected));
+
+    json_free(expected);
+    json_free(patch);
+    json_free(json);
+}
+
+int
+main(void)
+{
+    const char *target = "{\"a\": {\"b\": 1, \"c\": [1, 2, 3]}, \"d\": 4}";
+
+    /* Moves to a missing parent or past the end of an array fail whole. */
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/b\", \"path\": \"/x/y\"}]",
+                false, target);
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/c/0\", \"path\": \"/x/0\"}]",
+                false, target);
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/c/0\", \"path\": \"/a/c/5\"}]",
+                false, target);
+
+    /* Moves that succeed, including within one array. */
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/b\", \"path\": \"/e\"}]",
+                true, "{\"a\": {\"c\": [1, 2, 3]}, \"d\": 4, \"e\": 1}");
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/c/0\", \"path\": \"/a/c/2\"}]",
+                true, "{\"a\": {\"b\": 1, \"c\": [2, 3, 1]}, \"d\": 4}");
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/b\", \"path\": \"/a/c/-\"}]",
+                true, "{\"a\": {\"c\": [1, 2, 3, 1]}, \"d\": 4}");
+    check_patch(target, "[{\"op\": \"move\", \"from\": \"/a/c\", \"path\": \"/a\"}]",
+                true, "{\"a\": [1, 2, 3], \"d\": 4}");
+
+    /* A merge patch of nulls only still refuses a frozen target. */
+    struct json *frozen = parse(target);
+    struct json *nulls = parse("{\"d\": null, \"x\": null}");
+    assert(json_freeze(frozen));
+    assert(!json_merge_patch(frozen, nulls));
+    assert(json_object_get(frozen, (const uint8_t *)"d"));
+    json_free(nulls);
+    json_free(frozen);
+    return 0;
+}
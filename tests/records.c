@@ -0,0 +1,49 @@
+/**
+ * Record filters with as many terms as a predicate can hold.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+
+static bool
+count_record(void *context, const struct json *record)
+{
+    (void)record;
+    ++*(size_t *)context;
+    return true;
+}
+
+int
+main(void)
+{
+    char predicate[2048], records[4096];
+    size_t p = 0, r = 0;
+
+    /* 64 terms, each naming a different field of the first record. */
+    for (int i = 0; i < 64; i++)
+        p += sprintf(predicate + p, "%s/f%d == %d", i ? " && " : "", i, i);
+
+    for (int record = 0; record < 2; record++) {
+        r += sprintf(records + r, "{");
+        for (int i = 0; i < 64; i++)
+            r += sprintf(records + r, "%s\"f%d\": %d", i ? ", " : "", i, i + record);
+        r += sprintf(records + r, "}\n");
+    }
+
+    struct json_predicate *compiled = json_predicate_compile((const uint8_t *)predicate);
+    assert(compiled);
+
+    size_t visited = 0;
+    enum json_status status;
+    size_t accepted = json_records_filter((const uint8_t *)records, r,
+                                          JSON_RECORDS_LINES, compiled,
+                                          count_record, &visited, &status);
+    assert(status == JSON_SUCCESS);
+    assert(accepted == 1 && visited == 1);
+
+    json_predicate_free(compiled);
+    return 0;
+}